@@ -15,7 +15,7 @@ int main(int argc, char *argv[]) {
     int ec;
     GstBus *bus;
 
-    uint8_t *data; // image data
+    Frame frame; // mapped view of the current camera frame
 
     ec = load_settings_from_path(argv[1], &settings);
     if (ec) {
@@ -33,17 +33,9 @@ int main(int argc, char *argv[]) {
 
     bus = gst_element_get_bus(streams.pipeline);
 
-    // allocating data 
-    data = (uint8_t *)malloc(settings.np * settings.stride);
-    if (data == NULL) {
-        perror("Image data allocation failed\n");
-        exit(2);
-    }
-
     printf("\nPress <Enter> once:\n");
     int key_ent = getchar();
     int i = 1 - SKIP_FRAMES;
-    image_u8_t *im = image_u8_create(settings.width, settings.height);
 
     printf("Press <Enter> to capture image:");
 
@@ -51,7 +43,7 @@ int main(int argc, char *argv[]) {
     while(TRUE) {
         
         // pulling sample from camera and print bus error message, the only gstream functions used in a loop
-        ec = gstream_pull_sample(&streams, data, &settings);
+        ec = gstream_pull_frame(&streams, &frame, &settings);
         if (ec) {
             printf("Sample not taken\n");
             continue;
@@ -60,15 +52,13 @@ int main(int argc, char *argv[]) {
         if (i < 1) {
             i++;
             printf("Skipped frame\n");
+            gstream_release_frame(&frame);
             continue;
         }
         
-        if (getchar() != key_ent) continue;
-        // copy captured image to the buffer, this accomodates extra row space in im
-        for (int i = 0; i < settings.height; i++) {
-            uint8_t* row_d = im->buf + i * im->stride;
-            uint8_t* row_s = data + i * settings.width;
-            memcpy(row_d, row_s, settings.width);
+        if (getchar() != key_ent) {
+            gstream_release_frame(&frame);
+            continue;
         }
 
         // write to specific location
@@ -77,7 +67,8 @@ int main(int argc, char *argv[]) {
         snprintf(path, 100, "%s%d.pnm", settings.images_directory, i);
         printf("%s\n", path);
 
-        ec = image_u8_write_pnm(im, path);
+        ec = image_u8_write_pnm(&frame.im, path);
+        gstream_release_frame(&frame);
         if (ec) {
             printf("Image failed to write, error code %d\n", ec);
             continue;
@@ -94,9 +85,6 @@ int main(int argc, char *argv[]) {
         g_printerr("Cleanup returned error code: %d\n", ec);
         exit(4);
     }
-    
-    // free dynamically allocated image data array
-    free(data);
 
     exit(0);
 }
\ No newline at end of file
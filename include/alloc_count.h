@@ -0,0 +1,16 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ALLOC_WARMUP_FRAMES 100 // frames per stage thread before allocations count as steady state
+
+// heap allocations (malloc, calloc and realloc) made so far by the calling thread, libraries included
+// only counted in builds with ALLOC_ACCOUNTING, which replaces malloc, otherwise always 0
+uint64_t alloc_count_thread(void);
+
+// whether this build counts allocations at all
+int alloc_count_enabled(void);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define CLOCK_SYNC_WINDOW 32 // exchanges the offset and drift are fitted over
+#define CLOCK_SYNC_SLACK 2000 // us, how much longer than the quickest round trip in the window an exchange may take
+#define CLOCK_SYNC_MAX_DRIFT 1e-3 // crystals are good to a few hundred ppm, anything beyond is a bad fit
+#define CLOCK_SYNC_MIN_SAMPLES 4 // exchanges needed before the sync is used
+
+// one ping/pong exchange, the offset is remote - local at local time t
+typedef struct _SyncSample {
+    int64_t t; // us, local time halfway through the exchange
+    int64_t offset; // us
+    int64_t delay; // us, round trip minus the time the remote side held on to the ping
+} SyncSample;
+
+// offset and drift of the remote clock against CLOCK_MONOTONIC, NTP style
+// remote = local + offset + drift * (local - t0), fitted to the quick exchanges of the last CLOCK_SYNC_WINDOW
+typedef struct _ClockSync {
+    SyncSample samples[CLOCK_SYNC_WINDOW];
+    uint32_t head, count;
+
+    int64_t t0; // us, local time the fit is centred on
+    double offset; // us at t0
+    double drift; // us per us
+    int valid;
+
+    uint64_t exchanges; // pongs taken in
+    uint64_t rejected; // pongs that took too long to say much about the offset
+} ClockSync;
+
+void clock_sync_init(ClockSync *cs);
+
+// takes in one exchange, t1 and t4 local send and receive times, t2 and t3 remote receive and reply times
+// returns 1 if it was too slow to be used
+int clock_sync_add(ClockSync *cs, int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+int64_t clock_sync_to_remote(const ClockSync *cs, int64_t local);
+int64_t clock_sync_to_local(const ClockSync *cs, int64_t remote);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef DECODER_CACHE_H
+#define DECODER_CACHE_H
+
+#include <apriltag/apriltag.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DECODER_CACHE_MAGIC "ATQD001" // 8 bytes with the terminator
+
+// same layout as the private quick decode table apriltag.c hangs off family->impl
+typedef struct _QuickDecodeEntry {
+    uint64_t rcode; // code as read from the image, UINT64_MAX for an empty bucket
+    uint16_t id;
+    uint8_t hamming;
+    uint8_t rotation;
+} QuickDecodeEntry;
+
+typedef struct _QuickDecode {
+    int nentries;
+    QuickDecodeEntry *entries; // open addressed hash table, nentries buckets
+} QuickDecode;
+
+// start of a cache file, the entries follow it directly
+// the family's codes are hashed so a changed family never loads a stale table
+typedef struct _DecoderCacheHeader {
+    char magic[8];
+    char family[32];
+    uint32_t nbits;
+    uint32_t ncodes;
+    int32_t hamming;
+    uint32_t entry_size;
+    uint64_t codes_hash;
+    uint64_t nentries;
+} DecoderCacheHeader;
+
+// a table mapped from the cache, owned here instead of by the detector
+typedef struct _DecoderCache {
+    void *map;
+    size_t size;
+    QuickDecode qd;
+    uint8_t loaded; // fam->impl points at qd
+} DecoderCache;
+
+// maps <dir><family>_h<hamming>.qd and attaches it to fam, returns 0 if a valid table was found
+// apriltag_detector_add_family_bits then skips building its own
+int decoder_cache_load(DecoderCache *cache, const char *dir, apriltag_family_t *fam, int hamming);
+
+// writes the table apriltag built for fam so the next start can load it
+int decoder_cache_store(const char *dir, apriltag_family_t *fam, int hamming);
+
+// detaches and unmaps a loaded table, call before apriltag_detector_destroy which would free() it otherwise
+void decoder_cache_release(DecoderCache *cache, apriltag_family_t *fam);
+
+#endif
@@ -4,6 +4,10 @@
 // external functionality
 #include <settings.h>
 #include <gstream_from_cam.h>
+#include <timestamps.h>
+#include <roi_tracker.h>
+#include <grid_pose.h>
+#include <decoder_cache.h>
 
 // apriltag functionality
 #include <apriltag/apriltag.h>
@@ -27,10 +31,13 @@
 
 #define MAX_DETECTIONS 16
 
-int apriltag_setup(apriltag_detector_t **td, apriltag_family_t **tf, apriltag_detection_info_t *info, Settings *settings);
+int apriltag_setup(apriltag_detector_t **td, apriltag_family_t **tf, apriltag_detection_info_t *info, DecoderCache *cache, Settings *settings);
 
-int apriltag_detect(apriltag_detector_t *td, uint8_t *imdata, apriltag_detection_info_t *info, apriltag_pose_t *poses, Settings *settings, int *ids, uint8_t *nids);
+// poses must hold MAX_DETECTIONS preallocated 3x3 R and 3x1 t, they are overwritten with every frame's poses
+// err gets the RMS reprojection error in pixels of the joint pose, or of the first tag's pose without one
+// worker is the detector instance's index, it names the debug image so instances don't overwrite each other's
+int apriltag_detect(apriltag_detector_t *td, image_u8_t *im, apriltag_detection_info_t *info, apriltag_pose_t *poses, Settings *settings, ROITracker *tracker, PoseTracker *warm, TagMap *map, int *ids, uint8_t *nids, double *err, StageTimes *times, int worker);
 
-int apriltag_cleanup(apriltag_detector_t **td, apriltag_family_t **tf, apriltag_detection_info_t *info);
+int apriltag_cleanup(apriltag_detector_t **td, apriltag_family_t **tf, apriltag_detection_info_t *info, DecoderCache *cache);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef DETECT_TUNER_H
+#define DETECT_TUNER_H
+
+#include <settings.h>
+
+#include <apriltag/apriltag.h>
+#include <apriltag/apriltag_pose.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TUNE_EWMA 0.2 // weight of the newest detection time in the running average
+#define TUNE_HYSTERESIS 0.15 // fraction of the budget either side of it where nothing changes
+#define TUNE_HOLD_FRAMES 10 // frames to wait after a change before judging the next one
+#define TUNE_LOST_FRAMES 5 // frames without tags before going back to the finest decimation
+#define TUNE_MIN_TAG_PX 24.0 // smallest tag side in decimated pixels that still gives reliable quads
+#define TUNE_MIN_CLUSTER 5 // the detector's own default for qtp.min_cluster_pixels
+#define TUNE_CLUSTER_CHANGE 0.25 // relative change of min_cluster_pixels needed before it is applied
+
+// per detector state for keeping detection inside a time budget at every altitude
+// only quad_decimate values the detector treats differently are used, it truncates everything but 1.5
+typedef struct _DetectTuner {
+    int64_t budget; // target detection time per frame in us
+    double fx; // focal length in pixels
+    double tag_size; // tag side in meters
+
+    int level; // index into the decimation ladder
+    int min_level, max_level; // ladder range allowed by dec_min and dec_max
+
+    double avg; // running average of detection time in us, 0 before the first frame
+    double tag_px; // smallest expected tag side in full pixels from the last poses, 0 when unknown
+    uint16_t hold; // frames left before another change
+    uint16_t lost; // consecutive frames without detections
+
+    uint64_t changes; // times quad_decimate was changed
+} DetectTuner;
+
+int tuner_init(DetectTuner *tuner, apriltag_detector_t *td, Settings *settings);
+
+// adjusts td for the next frame from how long this one took and how far away its tags were
+// poses holds the nids per-tag poses of the frame, only read when status is 0
+int tuner_update(DetectTuner *tuner, apriltag_detector_t *td, apriltag_pose_t *poses, uint8_t nids, int status, int64_t detect_time);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef FLIGHT_LOG_H
+#define FLIGHT_LOG_H
+
+// binary flight recorder, fixed size records in a memory mapped ring file
+// a record costs a copy into the mapping, the kernel writes the pages back on its own time
+// with sync_ms a flusher thread also msyncs what was written since its last pass, so a power cut loses at most that long
+// the file keeps the last capacity records, tools/log2csv turns it into the CSV the text logger writes
+//
+// file layout: FlightLogHeader padded to FLIGHT_LOG_DATA_OFFSET, then capacity LogRecords, record n in slot n % capacity
+
+#include <timestamps.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define FLIGHT_LOG_MAGIC "FLOG0001"
+#define FLIGHT_LOG_DATA_OFFSET 4096 // records start on their own page
+#define FLIGHT_LOG_MAX_IDS 16 // same as MAX_DETECTIONS
+#define FLIGHT_LOG_EXTENSION ".bin"
+
+// one logged pose, everything a CSV line is made from
+typedef struct _LogRecord {
+    uint64_t index; // n + 1, written last, 0 or anything else means the slot doesn't hold record n
+    int64_t wall_us; // gettimeofday when it was logged
+    int32_t dt_ms; // since the previous record, as the CSV's dt column
+    uint8_t nids;
+    uint8_t predicted;
+    int8_t status; // transmit_pose's return, how many outputs dropped the pose or negative if none took it
+    uint8_t reserved;
+    StageTimes times;
+    int64_t time; // us, the pose's own time
+    double p[3];
+    double q[4]; // x, y, z, w
+    int32_t ids[FLIGHT_LOG_MAX_IDS];
+} LogRecord;
+
+typedef struct _FlightLogHeader {
+    char magic[8];
+    uint32_t record_size; // sizeof(LogRecord), a reader built with another layout refuses the file
+    uint32_t options; // LO_ flags of the logger, which columns the CSV gets
+    uint64_t capacity; // records the ring holds
+    uint64_t head; // records written so far
+} FlightLogHeader;
+
+typedef struct _FlightLog {
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    FlightLogHeader *header;
+    LogRecord *records;
+
+    int64_t sync_us; // between msyncs, 0 leaves write back to the kernel
+    uint64_t synced; // records up to here are on disk, only touched by the flusher
+    pthread_t flusher;
+    int running;
+} FlightLog;
+
+// creates the file at its full size and maps it, sync_ms 0 doesn't start the flusher
+int flight_log_open(FlightLog *fl, const char *path, uint64_t capacity, uint32_t options, int sync_ms);
+
+// copies one record in, only one thread may write, never blocks and never allocates
+static inline void flight_log_write(FlightLog *fl, const LogRecord *rec) {
+    uint64_t n = fl->header->head;
+    LogRecord *slot = &fl->records[n % fl->header->capacity];
+
+    memcpy(slot, rec, sizeof(LogRecord));
+    __atomic_store_n(&slot->index, n + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&fl->header->head, n + 1, __ATOMIC_RELEASE);
+}
+
+// stops the flusher, syncs whatever is left and unmaps
+int flight_log_close(FlightLog *fl);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef GRID_POSE_H
+#define GRID_POSE_H
+
+#include <settings.h>
+#include <tag_map.h>
+#include <pose_math.h>
+
+#include <apriltag/apriltag.h>
+#include <apriltag/apriltag_pose.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define GRID_POSE_MAX_TAGS 16 // same as MAX_DETECTIONS
+#define GRID_POSE_ITERATIONS 10 // Gauss-Newton steps at most, it usually converges in 2 or 3
+#define GRID_POSE_STEP_EPS 1e-10 // squared step size, rotation in rad and translation in m, below which it stops
+#define GRID_POSE_MAX_ERROR 3.0 // px, a joint solve worse than this doesn't fit the map and is rejected
+
+#define POSE_TRACKED_MAX 16 // tags whose last pose is kept, same as MAX_DETECTIONS
+#define POSE_WARM_ITERATIONS 4 // steps from the previous pose, it moves little between frames
+#define POSE_WARM_MAX_AGE 200000 // us, older poses are too far off to start from
+#define POSE_WARM_MAX_ERROR 2.0 // px, a warm solve worse than this is redone cold
+
+// last pose of one tag, or of the camera relative to the map origin for the joint solve
+typedef struct _TrackedPose {
+    int id;
+    double R[9];
+    double t[3];
+    int64_t time; // capture time of the frame it was solved in
+} TrackedPose;
+
+// per detector poses from its previous frames, so a smoothly moving camera doesn't need cold solves
+// starting next to the previous pose also picks the ambiguity branch that is continuous with it
+typedef struct _PoseTracker {
+    TrackedPose tags[POSE_TRACKED_MAX];
+    int ntags;
+    TrackedPose grid; // joint pose, any set of visible tags can start from it
+    uint8_t has_grid;
+
+    double max_jump; // m, a warm solve that moved further than this is redone cold
+
+    uint64_t warm; // solves started from a previous pose
+    uint64_t cold; // solves from scratch, new tags, stale poses and large jumps
+    uint64_t rejected; // joint solves worse than GRID_POSE_MAX_ERROR
+} PoseTracker;
+
+int pose_tracker_init(PoseTracker *pt, Settings *settings);
+
+// pose of one tag, refined from its previous pose when there is a recent one and solved cold otherwise
+// pt may be NULL, which always solves cold
+// pose->R and pose->t must already be 3x3 and 3x1, they are written in place
+// returns the RMS reprojection error in pixels, whichever way it was solved
+double tag_pose_estimate(PoseTracker *pt, apriltag_detection_info_t *info, apriltag_detection_t *det, int64_t time, apriltag_pose_t *pose);
+
+// solves one camera pose from the corners of all n detections at once, using their poses in the map
+// it is seeded from the previous joint pose in pt, or from orthogonal iteration on the largest tag only
+// poses gets the pose of every detection relative to its own tag, all consistent with the joint solve
+// written into the matrices already in poses, like tag_pose_estimate
+// returns the RMS reprojection error in pixels, or a negative value if the solve failed, didn't fit the map
+// within GRID_POSE_MAX_ERROR or a tag isn't in the map
+double grid_pose_estimate(apriltag_detection_info_t *info, apriltag_detection_t **dets, int n, TagMap *map,
+        PoseTracker *pt, int64_t time, apriltag_pose_t *poses);
+
+#endif
@@ -2,12 +2,43 @@
 #define GSTREAM_FROM_CAM_H
 
 #include <settings.h>
+#include <timestamps.h>
+#include <preprocess.h>
 
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include <apriltag/common/image_u8.h>
 
 #include <stdint.h>
 
+// how long native capture may take to deliver its first frame before falling back
+#define NEGOTIATE_TIMEOUT (2 * GST_SECOND)
+
+// preprocessed frames that can be out at once, one per detector instance and one being filled
+#define PRE_BUFFERS 10
+
+// single slot filled by the appsink callback, only the newest sample is ever kept
+typedef struct _CaptureSlot {
+    GMutex lock;
+    GCond ready;
+    GstSample *latest; // newest sample not yet taken, NULL when empty
+    gint64 capture; // monotonic time in us when latest was exposed, from its PTS
+    gint64 arrival; // monotonic time in us when latest arrived
+
+    uint64_t received; // samples delivered by the pipeline
+    uint64_t taken; // samples handed to the detector
+    uint64_t dropped; // samples replaced by a newer one before being taken
+} CaptureSlot;
+
+// counters copied out of the capture slot
+typedef struct _CaptureStats {
+    uint64_t received;
+    uint64_t taken;
+    uint64_t dropped;
+} CaptureStats;
+
 // a type to contain all relevant gstreamer and image parameters
 typedef struct _StreamSet {
     GstElement *pipeline;
@@ -17,12 +48,42 @@ typedef struct _StreamSet {
     GstElement *convert;
     GstElement *scale;
     GstElement *sink;
+
+    uint8_t mode; // capture mode actually in use, refer to captureModes enum
+
+    CaptureSlot slot;
+
+    // CAPTURE_FUSED only, gray frames are written to these and the sample is released right away
+    Preprocessor pre;
+    uint8_t *buffers[PRE_BUFFERS];
+    uint8_t busy[PRE_BUFFERS]; // set while a frame holds the buffer
+    int stride; // row length of the buffers
 } StreamSet;
 
+// a mapped view of one captured frame, im.buf points into the sample's buffer until the frame is released
+// frames that don't come from the camera have no sample and instead hold a pool buffer through hold
+typedef struct _Frame {
+    GstSample *sample;
+    GstBuffer *buffer;
+    GstMapInfo map;
+    uint8_t *hold; // busy flag of the pool buffer im.buf points into, cleared on release
+    image_u8_t im; // grayscale plane with the buffer's own stride, no copy is made
+
+    uint64_t seq; // sample number from the capture slot, gaps are dropped frames
+    StageTimes times; // capture and arrival are filled by the source, the rest by each later stage
+    gint64 age; // time in us between the frame being captured and the detector taking it
+} Frame;
+
 // function declarations, #TODO: document these
 int gstream_setup(StreamSet *cd, Settings *settings, uint8_t emit_signals, uint8_t sync);
 
-int gstream_pull_sample(StreamSet *ss, uint8_t *data, Settings *settings);
+// takes the newest sample, waiting up to one frame period, and maps it as a frame view
+// release it with gstream_release_frame once detection is done, this works for frames from any source
+int gstream_pull_frame(StreamSet *ss, Frame *frame, Settings *settings);
+
+int gstream_release_frame(Frame *frame);
+
+int gstream_get_stats(StreamSet *ss, CaptureStats *stats);
 
 int print_bus_message(GstBus *bus, StreamSet *ss);
 
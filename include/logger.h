@@ -13,9 +13,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#include <apriltag/common/matd.h>
+#include <pose_math.h>
+
+#include <timestamps.h>
+#include <flight_log.h>
 
-#define LOG_DIR "/home/natec/apriltag_rpi_positioning/output/"
 #define DEFAULT_LOG_NAME "log"
 #define LOG_EXTENSION ".csv"
 
@@ -27,9 +29,15 @@
 #define LO_EN_IDS 0b00010000
 #define LO_EN_POSES 0b00100000
 #define LO_EN_QUATS 0b01000000
+#define LO_EN_STAGES 0b10000000
 
 typedef struct Logger {
     int log_fd;
+    uint8_t options;
+
+    // records go into the mapped ring file instead of being formatted, tools/log2csv makes the CSV later
+    bool binary;
+    FlightLog flight;
 
     bool do_logging;
     bool log_images;
@@ -38,13 +46,24 @@ typedef struct Logger {
     bool log_ids;
     bool log_poses;
     bool log_quats;
+    bool log_stages;
 } Logger;
 
-int name_logfile(char *buf);
+// first unused name in dir, the settings' output_directory, with the extension ext
+int name_logfile(char *buf, const char *dir, const char *ext);
 
 int init_logger(Logger *logger, const char *log_file_path, uint8_t options);
 
-int log_message(Logger *logger, matd_t *p, matd_t *q, int *ids, int num_ids, struct timeval *tstart, struct timeval *tstop);
+// same columns, written as LogRecords into a flight log of capacity records, refer to flight_log.h
+int init_binary_logger(Logger *logger, const char *log_file_path, uint8_t options, uint64_t capacity, int sync_ms);
+
+// time and predicted are the pose's own time and whether it was extrapolated, logged with the stage times
+// status is what transmit_pose returned for it, only the binary log keeps it
+int log_message(Logger *logger, Vec3 *p, Quat *q, int64_t time, uint8_t predicted, int status, int *ids, int num_ids, StageTimes *times, struct timeval *tstart, struct timeval *tstop);
+
+// the CSV header and one line for a record, shared by the text log and log2csv so both give the same file
+void log_csv_header(int fd, uint8_t options);
+void log_record_csv(int fd, uint8_t options, const LogRecord *rec);
 
 int close_logger(Logger *logger);
 
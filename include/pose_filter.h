@@ -0,0 +1,53 @@
+#ifndef POSE_FILTER_H
+#define POSE_FILTER_H
+
+#include <settings.h>
+#include <pose_math.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#define KF_INIT_VEL_STD 1.0 // m/s, velocity uncertainty when the filter starts, it is unknown then
+#define KF_INIT_RATE_STD 1.0 // rad/s, same for the angular rate
+
+// one axis of a constant velocity model, x is the value and v its rate
+// P is the symmetric 2x2 covariance stored as P00, P01, P11
+typedef struct _AxisFilter {
+    double x, v;
+    double P[3];
+} AxisFilter;
+
+// constant velocity on position and constant angular rate on attitude
+// position is filtered per axis in the grid frame
+// attitude is kept as a quaternion and filtered as a small rotation per body axis,
+// which is folded into the quaternion after every update, so att[i].x stays 0 in between
+typedef struct _PoseFilter {
+    AxisFilter pos[3];
+    AxisFilter att[3]; // v is the body rate in rad/s
+    Quat q;
+    int64_t time; // us, time the state is for, the last measurement's capture time
+    uint8_t valid; // has a state, cleared until the first measurement and after a long gap
+
+    double accel_noise; // (m/s^2)^2 s, spectral density of the unmodelled acceleration
+    double pos_noise; // m^2, measurement variance of the position
+    double ang_accel_noise; // (rad/s^2)^2 s, same for the angular acceleration
+    double att_noise; // rad^2, measurement variance of the attitude
+    int64_t max_gap; // us, a state older than this is neither predicted from nor updated, it restarts
+
+    uint64_t updates; // measurements filtered
+    uint64_t resets; // times the filter restarted from a measurement
+} PoseFilter;
+
+int pose_filter_init(PoseFilter *pf, Settings *settings);
+
+// predicts the state to the capture time of a measurement and corrects it, p and q get the filtered pose
+int pose_filter_update(PoseFilter *pf, Vec3 *p, Quat *q, int64_t time);
+
+// pose extrapolated to time without changing the state
+// returns 1 if there is no state or it is older than max_gap, p and q are left alone then
+int pose_filter_predict(PoseFilter *pf, int64_t time, Vec3 *p, Quat *q);
+
+// standard deviation of the position per grid axis and of the attitude per body axis at time, from the covariance
+void pose_filter_sigma(PoseFilter *pf, int64_t time, float pos_sigma[3], float att_sigma[3]);
+
+#endif
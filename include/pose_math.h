@@ -0,0 +1,181 @@
+#ifndef POSE_MATH_H
+#define POSE_MATH_H
+
+#include <math.h>
+
+// fixed size pose math on plain structs, everything lives on the stack or in the caller's struct
+// matrices are row major like matd, so matd data can be copied straight in
+
+typedef struct _Vec3 {
+    double v[3];
+} Vec3;
+
+typedef struct _Mat3 {
+    double m[9];
+} Mat3;
+
+// unit quaternion, stored in the order it is logged and transmitted
+typedef struct _Quat {
+    double x, y, z, w;
+} Quat;
+
+static inline Vec3 vec3_from_array(const double *a) {
+    Vec3 r = { { a[0], a[1], a[2] } };
+    return r;
+}
+
+static inline Mat3 mat3_from_array(const double *a) {
+    Mat3 r;
+    for (int i = 0; i < 9; i++) r.m[i] = a[i];
+    return r;
+}
+
+static inline Vec3 vec3_add(const Vec3 *a, const Vec3 *b) {
+    Vec3 r;
+    for (int i = 0; i < 3; i++) r.v[i] = a->v[i] + b->v[i];
+    return r;
+}
+
+static inline Vec3 vec3_sub(const Vec3 *a, const Vec3 *b) {
+    Vec3 r;
+    for (int i = 0; i < 3; i++) r.v[i] = a->v[i] - b->v[i];
+    return r;
+}
+
+static inline Vec3 vec3_scale(const Vec3 *a, double s) {
+    Vec3 r;
+    for (int i = 0; i < 3; i++) r.v[i] = a->v[i] * s;
+    return r;
+}
+
+static inline double vec3_dot(const Vec3 *a, const Vec3 *b) {
+    return a->v[0] * b->v[0] + a->v[1] * b->v[1] + a->v[2] * b->v[2];
+}
+
+static inline double vec3_norm(const Vec3 *a) {
+    return sqrt(vec3_dot(a, a));
+}
+
+static inline Mat3 mat3_transpose(const Mat3 *a) {
+    Mat3 r;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) r.m[i * 3 + j] = a->m[j * 3 + i];
+    }
+    return r;
+}
+
+static inline Mat3 mat3_mul(const Mat3 *a, const Mat3 *b) {
+    Mat3 r;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            r.m[i * 3 + j] = a->m[i * 3] * b->m[j] + a->m[i * 3 + 1] * b->m[3 + j] + a->m[i * 3 + 2] * b->m[6 + j];
+        }
+    }
+    return r;
+}
+
+static inline Vec3 mat3_mul_vec3(const Mat3 *a, const Vec3 *b) {
+    Vec3 r;
+    for (int i = 0; i < 3; i++) {
+        r.v[i] = a->m[i * 3] * b->v[0] + a->m[i * 3 + 1] * b->v[1] + a->m[i * 3 + 2] * b->v[2];
+    }
+    return r;
+}
+
+// a^T b without forming the transpose
+static inline Vec3 mat3_tmul_vec3(const Mat3 *a, const Vec3 *b) {
+    Vec3 r;
+    for (int i = 0; i < 3; i++) {
+        r.v[i] = a->m[i] * b->v[0] + a->m[3 + i] * b->v[1] + a->m[6 + i] * b->v[2];
+    }
+    return r;
+}
+
+// rotation matrix to quaternion, branching on the largest diagonal term to keep the division well conditioned
+static inline Quat quat_from_mat3(const Mat3 *a) {
+    const double *R = a->m;
+    double trace = R[0] + R[4] + R[8];
+    Quat q;
+
+    if (trace > 0) {
+        double S = sqrt(trace + 1.0) * 2; // S = 4 qw
+        q.w = 0.25 * S;
+        q.x = (R[7] - R[5]) / S;
+        q.y = (R[2] - R[6]) / S;
+        q.z = (R[3] - R[1]) / S;
+    }
+    else if (R[0] > R[4] && R[0] > R[8]) {
+        double S = sqrt(1.0 + R[0] - R[4] - R[8]) * 2; // S = 4 qx
+        q.w = (R[7] - R[5]) / S;
+        q.x = 0.25 * S;
+        q.y = (R[1] + R[3]) / S;
+        q.z = (R[2] + R[6]) / S;
+    }
+    else if (R[4] > R[8]) {
+        double S = sqrt(1.0 + R[4] - R[0] - R[8]) * 2; // S = 4 qy
+        q.w = (R[2] - R[6]) / S;
+        q.x = (R[1] + R[3]) / S;
+        q.y = 0.25 * S;
+        q.z = (R[5] + R[7]) / S;
+    }
+    else {
+        double S = sqrt(1.0 + R[8] - R[0] - R[4]) * 2; // S = 4 qz
+        q.w = (R[3] - R[1]) / S;
+        q.x = (R[2] + R[6]) / S;
+        q.y = (R[5] + R[7]) / S;
+        q.z = 0.25 * S;
+    }
+
+    return q;
+}
+
+// unit quaternion to rotation matrix
+static inline Mat3 mat3_from_quat(const Quat *q) {
+    double x = q->x, y = q->y, z = q->z, w = q->w;
+    Mat3 r = { {
+        1 - 2 * (y * y + z * z), 2 * (x * y - z * w), 2 * (x * z + y * w),
+        2 * (x * y + z * w), 1 - 2 * (x * x + z * z), 2 * (y * z - x * w),
+        2 * (x * z - y * w), 2 * (y * z + x * w), 1 - 2 * (x * x + y * y)
+    } };
+    return r;
+}
+
+// a b, rotating by b first and then by a
+static inline Quat quat_mul(const Quat *a, const Quat *b) {
+    Quat r;
+    r.w = a->w * b->w - a->x * b->x - a->y * b->y - a->z * b->z;
+    r.x = a->w * b->x + a->x * b->w + a->y * b->z - a->z * b->y;
+    r.y = a->w * b->y - a->x * b->z + a->y * b->w + a->z * b->x;
+    r.z = a->w * b->z + a->x * b->y - a->y * b->x + a->z * b->w;
+    return r;
+}
+
+static inline Quat quat_conj(const Quat *a) {
+    Quat r = { -a->x, -a->y, -a->z, a->w };
+    return r;
+}
+
+// rotation by the angle |r| about r
+static inline Quat quat_exp(const Vec3 *r) {
+    double angle = vec3_norm(r);
+    double s = angle > 1e-12 ? sin(0.5 * angle) / angle : 0.5; // sin(a/2)/a -> 1/2 for small angles
+    Quat q = { s * r->v[0], s * r->v[1], s * r->v[2], cos(0.5 * angle) };
+    return q;
+}
+
+// rotation vector of a unit quaternion, the shorter way round since q and -q are the same rotation
+static inline Vec3 quat_log(const Quat *q) {
+    double sign = q->w < 0 ? -1.0 : 1.0;
+    double n = sqrt(q->x * q->x + q->y * q->y + q->z * q->z);
+    double s = n > 1e-12 ? 2.0 * atan2(n, sign * q->w) / n : 2.0;
+    Vec3 r = { { sign * s * q->x, sign * s * q->y, sign * s * q->z } };
+    return r;
+}
+
+static inline Quat quat_normalize(const Quat *q) {
+    double n = sqrt(q->x * q->x + q->y * q->y + q->z * q->z + q->w * q->w);
+    Quat r = { q->x / n, q->y / n, q->z / n, q->w / n };
+    return r;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef POSE_PACKET_H
+#define POSE_PACKET_H
+
+// packets exchanged with the flight controller over the UART, kept free of the rest of the tracker so a receiver can
+// build it on its own
+// every packet is framed the same way, every field is little endian and there is no padding:
+//   0  sync        2  0xA5 0x5A
+//   2  version     1  POSE_PACKET_VERSION
+//   3  type        1  refer to packetTypes enum
+//   4  length      1  payload bytes that follow
+//   5  payload     length
+//   .  crc         2  CRC-16/CCITT-FALSE of everything from version up to here
+//
+// pose, tracker to controller, 40 bytes:
+//   0  seq         2  packet counter, wraps, a gap means packets were lost
+//   2  time        8  us, capture time or the time a predicted pose is for, on the controller's clock with POSE_FLAG_REMOTE_TIME
+//   10 position    12 3 floats, m in the map frame
+//   22 quaternion  16 4 floats, x, y, z, w
+//   38 ntags       1  tags the pose was measured from, 0 for a predicted pose
+//   39 flags       1  refer to poseFlags enum
+// compact pose, tracker to controller, 29 bytes, same fields in fixed point with an uncertainty added:
+//   0  seq         2
+//   2  time        6  us, low 48 bits of the same time, the receiver extends it from its own clock
+//   8  position    9  3 signed 24 bit integers, mm, saturates at +-8388 m
+//   17 quaternion  4  smallest three: bits 31-30 index of the largest component, which is made positive and left out,
+//                     then the other three in order, 10 bits each, mapped from [-1/sqrt(2), 1/sqrt(2)]
+//   21 ntags       1
+//   22 flags       1
+//   23 sigma       6  standard deviation of x, y, z in m and of the rotation about x, y, z in rad, the diagonal of the
+//                     covariance, one byte each: 0 unknown, else 1e-5 * 2^((code - 1) / 12), 255 saturates
+// ping, tracker to controller, 10 bytes: seq 2, t1 8 (tracker us when sent)
+// pong, controller to tracker, 26 bytes: seq 2, t1 8 (echoed), t2 8 (controller us when the ping arrived), t3 8 (when it replied)
+// attitude, controller to tracker, 24 bytes: time 8 (controller us), quaternion 16 (x, y, z, w, controller's own frame)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+
+#define POSE_SYNC0 0xA5
+#define POSE_SYNC1 0x5A
+#define POSE_PACKET_VERSION 1
+#define POSE_HEADER_SIZE 5
+#define POSE_PAYLOAD_SIZE 40
+#define PING_PAYLOAD_SIZE 10
+#define PONG_PAYLOAD_SIZE 26
+#define ATTITUDE_PAYLOAD_SIZE 24
+#define COMPACT_PAYLOAD_SIZE 29
+#define POSE_PACKET_SIZE (POSE_HEADER_SIZE + POSE_PAYLOAD_SIZE + 2)
+#define COMPACT_PACKET_SIZE (POSE_HEADER_SIZE + COMPACT_PAYLOAD_SIZE + 2)
+#define POSE_PACKET_MAX (POSE_HEADER_SIZE + 255 + 2) // largest packet any type can have
+
+enum packetTypes {
+    PACKET_POSE = 1,
+    PACKET_PING = 2,
+    PACKET_PONG = 3,
+    PACKET_ATTITUDE = 4,
+    PACKET_POSE_COMPACT = 5
+};
+
+enum poseFlags {
+    POSE_FLAG_PREDICTED = 0x01, // extrapolated between frames, no frame behind it
+    POSE_FLAG_FILTERED = 0x02, // passed through the Kalman filter
+    POSE_FLAG_JOINT = 0x04, // solved over several tags at once
+    POSE_FLAG_REMOTE_TIME = 0x08 // time is on the controller's clock, from the ping/pong exchange
+};
+
+typedef struct _PosePacket {
+    uint16_t seq;
+    uint64_t time;
+    float position[3];
+    float quat[4];
+    uint8_t ntags;
+    uint8_t flags;
+    float pos_sigma[3]; // m, only carried by the compact encoding, 0 when unknown
+    float att_sigma[3]; // rad, same
+} PosePacket;
+
+typedef struct _PingPacket {
+    uint16_t seq;
+    uint64_t t1;
+} PingPacket;
+
+typedef struct _PongPacket {
+    uint16_t seq;
+    uint64_t t1, t2, t3;
+} PongPacket;
+
+typedef struct _AttitudePacket {
+    uint64_t time;
+    float quat[4];
+} AttitudePacket;
+
+// receiver side state, bytes are fed in as they arrive and whole packets come out
+typedef struct _PacketParser {
+    uint8_t buf[POSE_PACKET_MAX];
+    size_t len; // bytes of the current candidate packet
+
+    uint8_t payload[255]; // payload of the last complete packet
+    uint8_t payload_len;
+
+    uint64_t packets; // packets of any known type decoded
+    uint64_t crc_errors; // candidates whose CRC didn't match
+    uint64_t unknown; // packets with a good CRC but a version this parser doesn't know
+    uint64_t skipped; // bytes thrown away while looking for the sync bytes
+} PacketParser;
+
+uint16_t packet_crc16(const uint8_t *data, size_t n);
+
+// frames a payload, buf must hold POSE_HEADER_SIZE + len + 2 bytes, returns the bytes written
+size_t packet_encode(uint8_t type, const uint8_t *payload, uint8_t len, uint8_t *buf);
+
+// write the whole packet into buf, which must hold POSE_PACKET_MAX bytes, and return the bytes written
+size_t pose_packet_encode(const PosePacket *pkt, uint8_t *buf);
+size_t ping_packet_encode(const PingPacket *pkt, uint8_t *buf);
+size_t pong_packet_encode(const PongPacket *pkt, uint8_t *buf);
+size_t attitude_packet_encode(const AttitudePacket *pkt, uint8_t *buf);
+size_t compact_pose_encode(const PosePacket *pkt, uint8_t *buf);
+
+// read a payload of the matching type, return 0 on success and 1 if the length is wrong
+int pose_payload_parse(const uint8_t *payload, size_t len, PosePacket *pkt);
+int ping_payload_parse(const uint8_t *payload, size_t len, PingPacket *pkt);
+int pong_payload_parse(const uint8_t *payload, size_t len, PongPacket *pkt);
+int attitude_payload_parse(const uint8_t *payload, size_t len, AttitudePacket *pkt);
+int compact_payload_parse(const uint8_t *payload, size_t len, PosePacket *pkt);
+
+// decodes one complete pose packet of n bytes, returns 0 on success
+// 1 wrong sync or too short, 2 CRC mismatch, 3 unknown version or not a pose in either encoding
+int pose_packet_decode(const uint8_t *buf, size_t n, PosePacket *pkt);
+
+void packet_parser_init(PacketParser *pp);
+
+// feeds one received byte, returns the type of the packet it completed, whose payload is then in pp, or 0
+// after a bad CRC the search restarts one byte after the rejected sync, so a sync inside the data can't lose a packet
+int packet_parser_feed(PacketParser *pp, uint8_t byte);
+
+// same for a receiver that only wants poses, returns 1 when a pose packet of either encoding completed, which is then in pkt
+int packet_parser_push(PacketParser *pp, uint8_t byte, PosePacket *pkt);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef POSE_SHM_H
+#define POSE_SHM_H
+
+// shared memory ring the tracker writes framed pose packets into, for readers on the same machine
+// kept free of the rest of the tracker like pose_packet.h, a reader only needs this header and pose_shm.c
+// there is one writer and any number of readers, nobody takes a lock and readers never slow the writer down
+// every slot has a sequence word, odd while the writer is inside the slot, so a reader can check in place
+// whether what it read was overwritten under it:
+//
+//   uint64_t n = pose_shm_head(&shm) - 1, token;
+//   size_t size;
+//   const uint8_t *data = pose_shm_begin(&shm, n, &size, &token);
+//   if (data != NULL && pose_packet_decode(data, size, &pkt) == 0 && pose_shm_end(&shm, n, token)) { use pkt }
+
+#include <pose_packet.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POSE_SHM_MAGIC 0x4D485350 // "PSHM"
+#define POSE_SHM_VERSION 1
+
+typedef struct _PoseShmHeader {
+    uint32_t magic; // written last, a reader that sees it sees the rest of the header
+    uint16_t version;
+    uint16_t slot_size; // bytes per slot, header included
+    uint32_t nslots;
+    uint32_t reserved;
+    uint64_t head; // packets written so far, packet n is in slot n % nslots
+    uint8_t pad[40]; // the head gets a cache line to itself
+} PoseShmHeader;
+
+typedef struct _PoseShmSlot {
+    uint64_t seq; // 2n + 1 while packet n is being written, 2n + 2 once it is complete
+    uint32_t size;
+    uint8_t data[POSE_PACKET_MAX];
+} PoseShmSlot;
+
+typedef struct _PoseShm {
+    PoseShmHeader *header;
+    PoseShmSlot *slots;
+    size_t map_size;
+    char name[64];
+    int writer;
+} PoseShm;
+
+// creates or resets the ring with nslots slots, name starts with a slash as for shm_open
+int pose_shm_create(PoseShm *shm, const char *name, uint32_t nslots);
+
+// maps an existing ring read only, 1 if it doesn't exist yet or isn't a ring of this version
+int pose_shm_attach(PoseShm *shm, const char *name);
+
+// unmaps, the writer also removes the name
+int pose_shm_close(PoseShm *shm);
+
+// copies one packet in, only the writer calls this
+void pose_shm_write(PoseShm *shm, const uint8_t *data, size_t size);
+
+static inline uint64_t pose_shm_head(const PoseShm *shm) {
+    return __atomic_load_n(&shm->header->head, __ATOMIC_ACQUIRE);
+}
+
+// packet n in place, NULL if it hasn't been written or was already overwritten
+static inline const uint8_t *pose_shm_begin(const PoseShm *shm, uint64_t n, size_t *size, uint64_t *token) {
+    const PoseShmSlot *slot = &shm->slots[n % shm->header->nslots];
+
+    *token = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (*token != 2 * n + 2) return NULL;
+
+    *size = slot->size;
+    if (*size > POSE_PACKET_MAX) return NULL;
+    return slot->data;
+}
+
+// true if packet n wasn't touched since pose_shm_begin, so whatever was read from it is good
+static inline int pose_shm_end(const PoseShm *shm, uint64_t n, uint64_t token) {
+    const PoseShmSlot *slot = &shm->slots[n % shm->header->nslots];
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == token;
+}
+
+#endif
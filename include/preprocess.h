@@ -0,0 +1,57 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PRE_MAX_FACTOR 4 // largest integer downscale
+#define PRE_CHECK_WIDTH 77 // output size of the self check, odd so the scalar tails get covered too
+#define PRE_CHECK_HEIGHT 9
+
+// gray is (15 B + 75 G + 38 R) / 128 per pixel, the weights fit in signed bytes for the vector multiplies
+// a downscaled pixel is the rounded mean over its factor x factor block, computed from the unrounded sums
+enum preKernels {
+    PRE_SCALAR = 0, // reference, any factor
+    PRE_SSSE3 = 1, // factors 1 and 2
+    PRE_AVX2 = 2, // factors 1 and 2
+    PRE_NEON = 3 // factors 1 and 2
+};
+
+// writes output pixels from the start of one output row, reading factor rows of BGRx from src
+// returns how many it wrote, the scalar reference does the rest
+typedef int (*pre_row_fn)(const uint8_t *src, int stride, uint8_t *dst, int width);
+
+// BGRx to gray, integer box downscale and an optional 3x3 binomial blur in one pass over the source
+// only three output rows are kept for the blur, so the source is read once and the rows stay in cache
+typedef struct _Preprocessor {
+    uint8_t factor;
+    uint8_t blur;
+    uint8_t kernel; // refer to preKernels enum
+    pre_row_fn row; // vector kernel for factor, NULL when only the scalar reference applies
+
+    int max_width; // widest output row the buffers fit
+    uint8_t *lines; // last three unblurred output rows
+    uint16_t *sums; // vertical blur sums of one row
+} Preprocessor;
+
+// picks the fastest kernel the CPU supports for factor and checks it against the reference
+int preprocess_init(Preprocessor *pre, uint8_t factor, uint8_t blur, int max_width);
+
+// converts src, at least width * factor by height * factor BGRx pixels, into a width by height gray image
+int preprocess_run(Preprocessor *pre, const uint8_t *src, int src_stride, int width, int height, uint8_t *dst, int dst_stride);
+
+// runs the selected kernel and the reference on a generated image, falls back to the reference if they differ
+// returns nonzero on a mismatch
+int preprocess_self_check(Preprocessor *pre);
+
+// forces one kernel instead of the fastest, for tests and benchmarks
+// returns nonzero if it isn't compiled in, the CPU doesn't support it or it has no version for the factor
+int preprocess_set_kernel(Preprocessor *pre, uint8_t kernel);
+
+const char *preprocess_kernel_name(uint8_t kernel);
+
+void preprocess_destroy(Preprocessor *pre);
+
+#endif
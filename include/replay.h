@@ -0,0 +1,76 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <settings.h>
+#include <gstream_from_cam.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dirent.h>
+
+#define REPLAY_BUFFERS 4 // frames that can be out at once, the detector only ever holds one
+#define RAW_MAGIC "ATRAW01" // 8 bytes with the terminator
+
+// header at the start of a raw recording
+// it is followed by records of an int64_t timestamp in us and width * height gray pixels, row by row
+typedef struct _RawHeader {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+} RawHeader;
+
+// a type to contain everything needed to play back recorded frames
+typedef struct _ReplaySet {
+    uint8_t mode; // SOURCE_PNM_DIR or SOURCE_RAW_FILE
+    uint8_t realtime; // pace frames by their timestamps, otherwise hand them out as fast as they are pulled
+    uint8_t loop; // start over at the end instead of finishing
+
+    // PNM directory, files sorted by the number in their name
+    char dir[PLEN];
+    struct dirent **names;
+
+    // raw recording
+    FILE *file;
+
+    int count; // number of frames in the recording
+    int index; // next frame to hand out
+    int width, height, stride;
+    gint64 period; // time between PNM frames in us, they have no timestamps of their own
+
+    uint8_t *buffers[REPLAY_BUFFERS];
+    uint8_t busy[REPLAY_BUFFERS]; // set while a frame holds the buffer
+
+    gint64 start; // monotonic time in us when the current pass started, 0 before the first frame
+    gint64 first; // timestamp of the first frame
+
+    uint64_t received; // frames read or skipped
+    uint64_t taken; // frames handed to the detector
+    uint64_t dropped; // frames skipped because a newer one was already due
+} ReplaySet;
+
+// writes frames to a raw recording that can be played back with SOURCE_RAW_FILE
+typedef struct _Recorder {
+    FILE *file;
+    int width, height;
+} Recorder;
+
+int replay_open(ReplaySet *rs, Settings *settings);
+
+// hands out the next frame as a view of a pool buffer, release it with gstream_release_frame
+// returns 1 once the recording is finished and looping is off
+int replay_pull_frame(ReplaySet *rs, Frame *frame);
+
+int replay_get_stats(ReplaySet *rs, CaptureStats *stats);
+
+int replay_close(ReplaySet *rs);
+
+int recorder_open(Recorder *rec, const char *path, int width, int height);
+
+int recorder_write(Recorder *rec, image_u8_t *im, gint64 timestamp);
+
+int recorder_close(Recorder *rec);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef ROI_TRACKER_H
+#define ROI_TRACKER_H
+
+#include <settings.h>
+
+#include <apriltag/apriltag.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_TRACKED 16 // same as MAX_DETECTIONS, tags past this aren't tracked
+#define ROI_MIN_SIZE 32 // smallest side of a region, smaller ones are grown around their center
+#define ROI_PAD 8 // pixels added on every side on top of the relative margin
+
+// a tag seen in the last search, with its corners and the motion of its center
+typedef struct _TrackedTag {
+    int id;
+    double p[4][2]; // corners in full frame pixels
+    double c[2]; // center in full frame pixels
+    double v[2]; // center velocity in pixels per us, 0 until the tag was seen twice
+    int64_t t; // capture time of the frame it was seen in
+} TrackedTag;
+
+// a rectangle of the frame to search, x1 and y1 exclusive
+typedef struct _ROI {
+    int x0, y0, x1, y1;
+} ROI;
+
+// per detector state for searching only around where tags are expected
+typedef struct _ROITracker {
+    TrackedTag tags[MAX_TRACKED];
+    int ntags;
+
+    float margin; // region growth around the predicted corners, relative to the tag's size in pixels
+    uint16_t full_interval; // search the whole frame at least every this many frames
+    uint8_t use_velocity; // shift the predicted corners by the tag's last velocity
+
+    uint16_t since_full; // frames since the last full search
+
+    uint64_t roi_searches; // frames searched only in regions
+    uint64_t full_searches; // frames searched whole, scheduled or after losing a tag
+} ROITracker;
+
+int roi_tracker_init(ROITracker *tracker, Settings *settings);
+
+// fills rois with the regions to search in a frame captured at t, returns how many
+// returns 0 when the whole frame should be searched instead
+int roi_tracker_plan(ROITracker *tracker, int64_t t, int width, int height, ROI *rois);
+
+// number of tracked tags that aren't among the detections
+int roi_tracker_missing(ROITracker *tracker, zarray_t *detections);
+
+// replaces the tracked tags with the detections of a frame captured at t
+int roi_tracker_update(ROITracker *tracker, zarray_t *detections, int64_t t, uint8_t full);
+
+// moves a detection made in a region back into full frame coordinates
+void roi_shift_detection(apriltag_detection_t *det, int x0, int y0);
+
+#endif
@@ -22,6 +22,20 @@ typedef struct _Settings {
     uint8_t framerate; // capture framerate
     uint32_t np; // number of pixels in output image
     uint8_t stride; // number of bytes per pixel, 1 or 2 for grayscale
+    uint8_t capture_mode; // how gray frames are produced, refer to captureModes enum
+    uint8_t prescale; // integer downscale from the sensor to the output size in CAPTURE_FUSED
+    uint8_t pre_blur; // 3x3 blur in CAPTURE_FUSED, set blur to 0 with it so frames aren't blurred twice
+
+    // frame source
+    uint8_t source_mode; // where frames come from, refer to sourceModes enum
+    char* replay_path; // PNM directory or raw recording to play back
+    uint8_t replay_realtime; // pace played back frames by their timestamps instead of as fast as possible
+    uint8_t replay_loop; // start over at the end of a recording instead of exiting
+    char* record_path; // raw recording written from every processed frame, empty to disable
+
+    // stage pipeline
+    uint8_t queue_depth; // number of slots between each pair of stages
+    uint8_t queue_policy; // what a stage does when the next one is behind, refer to queuePolicies enum
 
     // apriltags
     uint8_t debug; // do debugging
@@ -30,11 +44,34 @@ typedef struct _Settings {
     uint8_t iterations; // number of iterations to run on detection
 
     int hamming; // number of bit errors per detection
+    char* decoder_cache; // directory for the tag family decode tables, empty to always build them
     uint8_t threads; // number of threads to use, make 1 usually
+    uint8_t detectors; // independent detector instances working on consecutive frames, each uses threads threads
     float dec; // decimation factor on images, make 1.5, 2.0, 3.0, 4.0, etc.
     float blur; // blurring factor, 0.0 does nothing, >0.0 blurs, <0.0 sharpens
     uint8_t refine; // boolean for if refining
 
+    uint8_t adaptive_tuning; // adjust decimation and quad thresholds between frames to stay inside detect_budget_us
+    uint32_t detect_budget_us; // target detection time per frame
+    float dec_min, dec_max; // range the decimation is adjusted in, dec is where it starts
+
+    uint8_t roi_tracking; // search only around where tags were in the previous frame
+    float roi_margin; // region growth around the predicted corners, relative to the tag's size in pixels
+    uint16_t roi_full_interval; // search the whole frame at least every this many frames per detector
+    uint8_t roi_velocity; // extrapolate the corners with each tag's last velocity
+
+    uint8_t joint_pose; // solve one camera pose over every visible tag instead of one pose per tag
+    uint8_t warm_pose; // start pose solves from the previous frame's pose instead of from scratch
+    float warm_max_jump; // m, a warm solve that moved further than this is redone from scratch
+
+    uint8_t kalman_filter; // filter poses and send predicted ones between frames
+    uint16_t kf_rate; // Hz, rate predicted poses are sent at on top of the measured ones, 0 sends only those
+    uint32_t kf_max_predict; // us, how long after the last measurement poses are still predicted
+    float kf_accel_noise; // m/s^2, how hard the camera may accelerate
+    float kf_pos_noise; // m, standard deviation of a measured position
+    float kf_ang_accel_noise; // rad/s^2, same for turning
+    float kf_att_noise; // rad, standard deviation of a measured attitude
+
     uint8_t tag_family; // tag family, refer to tagTypes enum
     float tag_size; // the size of the tags in meters
 
@@ -50,10 +87,33 @@ typedef struct _Settings {
     uint8_t use_computed_center; // whether to choose center or compute it
     uint8_t center_id; // when using traditional grid layout, the id of the tag at center
 
+    char* tag_map_path; // tag map file, .json or binary, empty to build the map from the grid settings above
+    char* tag_map_save_path; // where to write the map in binary form once it is loaded, empty to not write it
+
     char* output_directory; // the folder where debug output will be created
 
+    uint8_t log_binary; // log into a memory mapped flight recorder file instead of CSV, tools/log2csv converts it
+    uint32_t log_records; // poses the flight recorder keeps, the oldest are overwritten
+    uint32_t log_sync_ms; // how often the flight recorder is msynced to disk, 0 leaves it to the kernel
+
     char* uart_path; // the UART device path
-    uint32_t uart_baudrate; // the UART baud rate
+    uint32_t uart_baudrate; // the UART baud rate, any rate the driver can do, 921600 and up included
+    uint32_t uart_report_ms; // how often the link's use is printed, 0 for only at exit
+    uint8_t clock_sync; // ping the controller to timestamp poses on its clock and read its attitude messages
+    uint16_t sync_interval_ms; // time between pings
+    float attitude_gate_deg; // drop poses whose rotation since the last one disagrees with the controller's by more, 0 to not check
+
+    // pose outputs, any number of them run at once
+    uint8_t output_uart; // the UART above, also opened for clock_sync without this
+    uint8_t output_udp; // a datagram per pose to udp_host:udp_port
+    char* udp_host;
+    uint16_t udp_port;
+    uint8_t output_unix; // a datagram per pose to the Unix socket a reader bound at unix_socket_path
+    char* unix_socket_path;
+    uint8_t output_shm; // the shared memory ring in pose_shm.h, for readers on the same board
+    char* shm_name; // starts with a slash, shows up in /dev/shm
+    uint32_t shm_slots; // poses kept in the ring
+    uint8_t compact_pose; // send the fixed point encoding with an uncertainty instead of floats, for slow links
 } Settings;
 
 enum tagTypes {
@@ -68,6 +128,18 @@ enum tagTypes {
     TAG48H12C = 8
 };
 
+enum captureModes {
+    CAPTURE_CONVERT = 0, // full HD BGRx from the sensor, converted and scaled to gray in the pipeline
+    CAPTURE_NATIVE = 1, // YUV at the output size from the sensor, Y plane used directly, falls back to CAPTURE_CONVERT
+    CAPTURE_FUSED = 2 // BGRx at prescale times the output size, converted, shrunk and blurred in one pass, falls back to CAPTURE_CONVERT
+};
+
+enum sourceModes {
+    SOURCE_CAMERA = 0, // live frames from libcamerasrc
+    SOURCE_PNM_DIR = 1, // a directory of PNM frames, like the calibration and debug images
+    SOURCE_RAW_FILE = 2 // a raw recording with a timestamp per frame, as written through record_path
+};
+
 int load_settings_from_path(const char* path, Settings *settings);
 
 #endif
\ No newline at end of file
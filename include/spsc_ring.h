@@ -0,0 +1,57 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// what a producer does when the ring is full
+enum queuePolicies {
+    QUEUE_BLOCK = 0, // wait for the consumer, back-pressure reaches all the way to the camera slot
+    QUEUE_DROP = 1 // give up on the new item and count it as dropped
+};
+
+// bounded single-producer/single-consumer ring of preallocated slots
+// items are written and read in place, the semaphores only count filled and free slots
+// and don't take a lock on the fast path
+typedef struct _SPSCRing {
+    uint8_t *slots;
+    size_t slot_size;
+    uint32_t capacity;
+    uint8_t policy; // refer to queuePolicies enum
+
+    uint64_t head; // next slot to read, only touched by the consumer
+    uint64_t tail; // next slot to write, only touched by the producer
+
+    sem_t items; // filled slots
+    sem_t spaces; // free slots
+
+    uint64_t pushed; // items published
+    uint64_t dropped; // items the producer gave up on because the ring was full
+} SPSCRing;
+
+int ring_init(SPSCRing *ring, uint32_t capacity, size_t slot_size, uint8_t policy);
+
+// returns the next free slot to fill, or NULL if none became free within timeout_us
+// a QUEUE_DROP ring doesn't wait and counts the attempt as dropped
+void *ring_claim(SPSCRing *ring, int64_t timeout_us);
+
+// makes the claimed slot visible to the consumer
+void ring_publish(SPSCRing *ring);
+
+// returns the oldest filled slot, or NULL if none arrived within timeout_us
+void *ring_peek(SPSCRing *ring, int64_t timeout_us);
+
+// hands the slot returned by ring_peek back to the producer
+void ring_release(SPSCRing *ring);
+
+// number of filled slots, only exact when neither side is running
+int ring_count(SPSCRing *ring);
+
+int ring_destroy(SPSCRing *ring);
+
+#endif
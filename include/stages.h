@@ -0,0 +1,138 @@
+#ifndef STAGES_H
+#define STAGES_H
+
+#include <settings.h>
+#include <gstream_from_cam.h>
+#include <replay.h>
+#include <detect_apriltags.h>
+#include <detect_tuner.h>
+#include <transmit_pose.h>
+#include <uart_link.h>
+#include <pose_filter.h>
+#include <logger.h>
+#include <spsc_ring.h>
+#include <alloc_count.h>
+
+#include <pthread.h>
+
+#define FRAME_QUEUE_DEPTH 1 // a queued frame only gets older, the capture slot already keeps the newest
+#define MAX_DETECTORS 8 // upper limit on independent detector instances working on consecutive frames
+#define STAGE_POLL_US 100000 // how long an idle stage waits before checking whether it should exit
+#define ATTITUDE_GATE_SPAN 500000 // us, longest gap between two poses whose rotations are still compared to the controller's
+#define ATTITUDE_GATE_RESET 3 // consecutive gated poses after which the last one becomes the reference, the old one was likely wrong
+
+// the stages in the order frames pass through them, each runs on its own thread
+// the detect stage runs one thread per detector instance, the filter stage only runs with kalman_filter
+enum stageIds {
+    STAGE_CAPTURE = 0,
+    STAGE_DETECT = 1,
+    STAGE_TRANSFORM = 2,
+    STAGE_FILTER = 3,
+    STAGE_TRANSMIT = 4,
+    STAGE_LOG = 5,
+    NSTAGES = 6
+};
+
+// result of detection on one frame, the pose matrices are created with the ring and reused for every frame
+typedef struct _DetectSlot {
+    uint64_t seq;
+    StageTimes times;
+    int status; // return code of apriltag_detect
+    double err; // px, RMS reprojection error of the pose the map pose comes from
+    apriltag_pose_t poses[MAX_DETECTIONS];
+    int ids[MAX_DETECTIONS];
+    uint8_t nids;
+} DetectSlot;
+
+// pose in the grid frame, held by value in the slot
+typedef struct _PoseSlot {
+    uint64_t seq;
+    StageTimes times;
+    Vec3 p; // position vector
+    Quat q; // quaternion
+    int64_t time; // us, capture time of the frame, or the time a predicted pose is for
+    uint8_t predicted; // extrapolated by the filter between frames, no frame or tags behind it
+    float pos_sigma[3]; // m, standard deviation in the map frame, from the reprojection error or the filter
+    float att_sigma[3]; // rad, same for the attitude
+    int8_t status; // what transmit_pose returned, only set on log entries
+    int ids[MAX_DETECTIONS];
+    uint8_t nids;
+} PoseSlot;
+
+struct _Stages;
+
+// one detector instance with its own family, decoder and detection info, fed every nth frame
+typedef struct _DetectWorker {
+    struct _Stages *st;
+    int index;
+
+    apriltag_detector_t *td;
+    apriltag_family_t *tf;
+    apriltag_detection_info_t info; // info.det is written per detection, so it can't be shared
+    DecoderCache cache; // decode table mapped from disk, if it was found there
+    ROITracker tracker; // tags this instance saw last, only used with roi_tracking
+    DetectTuner tuner; // adjusts td between frames, only used with adaptive_tuning
+    PoseTracker poses; // this instance's previous poses, only used with warm_pose
+
+    SPSCRing frames; // frames dispatched to this instance
+    SPSCRing detections; // its results, always blocking so the transform stage can rely on the order
+
+    pthread_t thread;
+} DetectWorker;
+
+// everything the stage threads share, the caller fills in the pointers and detectors before stages_start
+typedef struct _Stages {
+    Settings *settings;
+
+    // frame source, streams when source_mode is SOURCE_CAMERA and replay otherwise
+    StreamSet *streams;
+    ReplaySet *replay;
+    Recorder *recorder;
+
+    // frame n goes to workers[n % nworkers] and results are read back in the same order
+    DetectWorker workers[MAX_DETECTORS];
+    uint8_t nworkers;
+
+    TagMap *map;
+    TransportSet *outputs;
+    UARTLink *uart_link; // NULL without clock_sync
+    Logger *logger;
+
+    // capture -> worker frames -> detect -> worker detections -> transform -> poses -> transmit -> logs -> log
+    // with kalman_filter: transform -> poses -> filter -> estimates -> transmit
+    SPSCRing poses;
+    SPSCRing estimates;
+    SPSCRing logs;
+
+    PoseFilter filter; // only touched by the filter stage
+    uint64_t predicted; // predicted poses the filter sent
+    uint64_t gated; // poses the transform stage dropped for turning differently from the controller
+    uint64_t gate_resets; // times the gate took a gated pose as its new reference
+
+    int64_t started; // monotonic time in us the program started, for the time to the first pose
+    int64_t first_pose; // monotonic time in us the first pose was transmitted, 0 before that
+
+    // heap allocations and frames per stage after each thread's first ALLOC_WARMUP_FRAMES, only with ALLOC_ACCOUNTING
+    uint64_t allocs[NSTAGES];
+    uint64_t alloc_frames[NSTAGES];
+
+    pthread_t threads[NSTAGES];
+    int running; // cleared to make every stage exit
+    int done[NSTAGES]; // set by each stage on exit, once its input is empty the next stage exits too
+    int detect_running; // detect workers that haven't exited yet
+} Stages;
+
+// creates the rings and starts one thread per stage
+int stages_start(Stages *st);
+
+// true once every frame has gone all the way through, only happens when a replay finishes
+int stages_finished(Stages *st);
+
+// stops and joins every stage, releases anything still queued and prints the queue counters
+int stages_stop(Stages *st);
+
+// after stages_stop, nonzero if transform, filter, transmit or log allocated in steady state
+// or never got past the warm up, so a run that saw too few poses doesn't pass for a clean one
+int stages_steady_allocs(Stages *st);
+
+#endif
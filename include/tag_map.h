@@ -0,0 +1,68 @@
+#ifndef TAG_MAP_H
+#define TAG_MAP_H
+
+#include <settings.h>
+#include <pose_math.h>
+
+#include <json-c/json.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG_MAP_MAGIC "TAGMAP2" // 8 bytes with the terminator, 1 was the padded native struct
+#define TAG_MAP_HEADER_SIZE 12 // magic, then the record count as a little endian uint32
+#define TAG_MAP_RECORD_SIZE 44 // id 4, quaternion 4 x 4, position 3 x 8, packed
+#define TAG_MAP_MAX_ID 65535 // above every family's code count, bounds the dense array
+
+// where one tag is, in the frame poses are output in
+// a pose measured from this tag is mapped by p = t - R R_c^T t_c and attitude R R_c^T,
+// where R_c, t_c is the tag's pose in the camera frame as apriltag gives it
+// a tag laid like the grid has R = I and t at its grid position
+typedef struct _TagPose {
+    Mat3 R;
+    Vec3 t;
+    uint8_t valid; // the id is in the map
+} TagPose;
+
+// every tag of the field, indexed by id so a lookup is one array access
+typedef struct _TagMap {
+    TagPose *tags; // size entries
+    int size; // largest id + 1
+    int ntags; // valid entries
+} TagMap;
+
+// one record of the binary form, after a header of the magic and the record count
+// written field by field in little endian with no padding, so a map saved on one machine loads on any other
+// the rotation is kept as a quaternion and expanded to a matrix when loading
+typedef struct _TagMapRecord {
+    uint32_t id;
+    float quat[4]; // x, y, z, w
+    double position[3];
+} TagMapRecord;
+
+// builds the map from the grid settings, tags 0 to grid_units_x * grid_units_y - 1 laid out row by row
+int tag_map_from_grid(TagMap *map, Settings *settings);
+
+// loads a map file, a path ending in .json is read as the authoring format and anything else as the binary form
+// JSON: { "tags": [ { "id": 0, "position": [x, y, z], "rotation": [roll, pitch, yaw] }, ... ] }
+// the rotation is in degrees, applied roll first, and may be left out for a tag laid like the grid
+int tag_map_load(TagMap *map, const char *path);
+
+// writes the map in the binary form
+int tag_map_save(TagMap *map, const char *path);
+
+// tag_map_path if it is set, the grid otherwise, and saved to tag_map_save_path if that is set
+int tag_map_init(TagMap *map, Settings *settings);
+
+void tag_map_free(TagMap *map);
+
+// world pose of a tag, NULL if it isn't in the map
+static inline const TagPose *tag_map_get(const TagMap *map, int id) {
+    if (id < 0 || id >= map->size || !map->tags[id].valid) return NULL;
+    return &map->tags[id];
+}
+
+#endif
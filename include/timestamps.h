@@ -0,0 +1,25 @@
+#ifndef TIMESTAMPS_H
+#define TIMESTAMPS_H
+
+#include <stdint.h>
+#include <time.h>
+
+// monotonic time of each stage a frame passes through, all in us on the CLOCK_MONOTONIC time base
+// 0 means the stage hasn't happened (yet) for this frame
+typedef struct _StageTimes {
+    int64_t capture; // sensor exposure, from the buffer PTS
+    int64_t arrival; // sample reached the appsink
+    int64_t detect_start; // detector started on the frame
+    int64_t detect_end; // detections and per-tag poses done
+    int64_t transform; // pose transformed to the grid frame
+    int64_t transmit; // pose handed to the UART
+} StageTimes;
+
+// same clock as g_get_monotonic_time, for modules that don't use glib
+static inline int64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif
@@ -6,25 +6,35 @@
 #include <apriltag/apriltag_pose.h>
 
 #include <uart.h>
+#include <uart_tx.h>
+#include <transport.h>
+#include <timestamps.h>
+#include <pose_math.h>
+#include <tag_map.h>
+#include <pose_packet.h>
 #include <math.h>
 
-#define SMALL_NUM 0.0001
+#define POSE_MIN_REPROJ_ERROR 0.1 // px, floor on the error the uncertainty is worked out from
 
-typedef struct CoordDefs {
-    // center x and y from where tag id 0 is placed, z from ground level
-    float center_x, center_y, center_z;
-    // unit length and width of tiling in x and y, can be different
-    float ulength_x, uwidth_y;
-    // number of tags in the grid
-    uint8_t nx, ny;
-} CoordDefs;
-
-int init_transmit_pose(UARTInfo *uart_info, Settings *settings, CoordDefs *cd);
+int init_transmit_pose(UARTInfo *uart_info, Settings *settings);
 
 int compare_integers(const void *a, const void *b);
 
-int pose_transform(matd_t *p, matd_t *q, apriltag_pose_t *poses, CoordDefs *cd, int *ids, uint8_t nids);
+// camera pose in the map from the first detection's pose and that tag's place in the map
+// every id must be in the map, apriltag_detect leaves the others out
+int pose_transform(Vec3 *p, Quat *q, apriltag_pose_t *poses, TagMap *map, int *ids, uint8_t nids, StageTimes *times);
+
+// rough standard deviations of a measured pose in the map frame, from the RMS reprojection error err in pixels
+// of the solve, the range to the first tag in pose and the number of tags, q is the camera attitude in the map
+void pose_uncertainty(Settings *settings, apriltag_pose_t *pose, Quat *q, double err, uint8_t ntags,
+        float pos_sigma[3], float att_sigma[3]);
+
+// fills a packet from a pose, the uncertainty is left at 0, unknown, time is the capture time for a measured pose and the time it was predicted to otherwise
+void pose_packet_fill(PosePacket *pkt, uint16_t seq, Vec3 *p, Quat *q, int64_t time, uint8_t ntags, uint8_t flags);
 
-int transmit_pose(UARTInfo *uart_info, matd_t *p, matd_t *q);
+// encodes one packet, in the compact form if compact is set, and hands it to every output
+// the UART writer sends it with a single write
+// returns how many outputs were behind and dropped a packet, negative if none of them took it
+int transmit_pose(TransportSet *outputs, PosePacket *pkt, uint8_t compact, StageTimes *times);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <settings.h>
+#include <uart_tx.h>
+#include <pose_shm.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_TRANSPORTS 4
+
+// one way poses leave the tracker, every packet is encoded once and handed to each open transport
+// send must not block, a transport that can't take a packet right now drops it
+typedef struct _Transport {
+    const char *name;
+
+    // 0 when the packet went out or was queued, 1 when it or an older queued one was dropped, negative on an error
+    int (*send)(struct _Transport *t, const uint8_t *data, size_t size);
+    void (*close)(struct _Transport *t);
+
+    UARTTx *tx; // uart
+    int fd; // udp and unix
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    PoseShm shm; // shm
+
+    uint64_t sent, dropped, failed;
+    int last_errno; // so a missing reader is reported once, not per packet
+} Transport;
+
+typedef struct _TransportSet {
+    Transport transports[MAX_TRANSPORTS];
+    uint8_t n;
+} TransportSet;
+
+// the UART through its writer thread, tx must have been started
+int transport_uart_open(Transport *t, UARTTx *tx);
+
+// datagrams to host:port, a packet per datagram
+int transport_udp_open(Transport *t, const char *host, int port);
+
+// datagrams to a Unix socket bound by the reader, which may come and go
+int transport_unix_open(Transport *t, const char *path);
+
+// the shared memory ring in pose_shm.h
+int transport_shm_open(Transport *t, const char *name, uint32_t nslots);
+
+// opens every transport enabled in the settings, uart_tx is only used with output_uart
+int transports_open(TransportSet *ts, Settings *settings, UARTTx *uart_tx);
+
+// sends to every transport, returns how many dropped the packet or -1 if none took it
+int transports_send(TransportSet *ts, const uint8_t *data, size_t size);
+
+// closes every transport and prints its counters
+void transports_close(TransportSet *ts);
+
+#endif
@@ -8,6 +8,10 @@
 #include <termios.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+
+#include <uart_baud.h>
 
 #define UART_FILE_PATH "/dev/ttyS"
 
@@ -16,7 +20,9 @@
 typedef struct _UARTInfo {
     char device[24];
     int fd;
-    speed_t baud_rate;
+    speed_t baud_rate; // B constant, B38400 as a placeholder when the rate is set through termios2
+    int baud; // bits per second the driver actually runs at
+    uint8_t bits_per_char; // start, data, parity and stop bits, what one byte costs on the wire
     struct termios settings;
 } UARTInfo;
 
@@ -25,11 +31,15 @@ int uart_open(UARTInfo *info, const char *device_path);
 // closes the UART device with the specified file descriptor
 int uart_close(UARTInfo *info);
 // configures the UART device with the specified file descriptor and baud rate
+// rates without a termios B constant, 921600, 1000000, 2000000 and the like, are set through termios2
 int uart_configure(UARTInfo *info, int baud_rate, int parity, int stop_bits, int data_bits, int min_chars, int timeout);
-// writes data to the UART device with the specified file descriptor
+// writes data to the UART device with the specified file descriptor, returns without waiting for it to go out
+// may write less than size, 0 when the driver's buffer is full
 ssize_t uart_write(UARTInfo *info, const uint8_t *data, size_t size);
 // reads data from the UART device with the specified file descriptor
 ssize_t uart_read(UARTInfo *info, uint8_t *data, size_t size);
+// bytes written but still in the driver's transmit queue, negative if the driver can't tell
+int uart_outq(UARTInfo *info);
 
 
 
@@ -0,0 +1,15 @@
+#ifndef UART_BAUD_H
+#define UART_BAUD_H
+
+// baud rates termios has no B constant for, through the Linux termios2 interface
+// <asm/termbits.h> redefines struct termios, so this lives in its own file and only deals in ints
+
+// sets the input and output rate of an open, already configured tty to baud bits per second
+// everything else about the port is left as it was, returns 0 on success
+int uart_set_custom_baud(int fd, int baud);
+
+// output rate the driver actually runs at, which can be off from the one asked for by its clock divider
+// returns a negative value if it can't be read
+int uart_get_baud(int fd);
+
+#endif
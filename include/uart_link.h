@@ -0,0 +1,61 @@
+#ifndef UART_LINK_H
+#define UART_LINK_H
+
+#include <uart.h>
+#include <uart_tx.h>
+#include <pose_packet.h>
+#include <pose_math.h>
+#include <clock_sync.h>
+#include <timestamps.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UART_LINK_POLL_MS 20 // longest the reader waits for bytes before checking whether a ping is due
+#define UART_LINK_ATT_HISTORY 64 // attitudes kept for looking up the controller's rotation at a frame's time
+#define UART_LINK_ATT_HOLD 20000 // us, how far past the newest attitude it is still used as is
+
+typedef struct _AttitudeSample {
+    int64_t time; // us, local clock
+    Quat q;
+} AttitudeSample;
+
+// receive side of the UART and the ping/pong exchange, on its own thread
+// packets to the controller go out through the same UARTTx as the poses so writes never interleave
+typedef struct _UARTLink {
+    UARTInfo *uart;
+    UARTTx *tx;
+    int64_t interval; // us between pings
+
+    PacketParser parser;
+    uint16_t ping_seq;
+
+    pthread_mutex_t lock; // guards sync and the attitude history, which the stage threads read
+    ClockSync sync;
+    AttitudeSample attitudes[UART_LINK_ATT_HISTORY];
+    uint32_t att_head, att_count;
+
+    pthread_t thread;
+    int running;
+
+    uint64_t pings, pongs, stale_pongs, attitudes_received;
+} UARTLink;
+
+// starts the reader, which pings the controller every interval_ms
+int uart_link_start(UARTLink *link, UARTInfo *uart, UARTTx *tx, int interval_ms);
+
+// stops and joins the reader and prints the link counters
+int uart_link_stop(UARTLink *link);
+
+// local time on the controller's clock, returns 1 while there have been too few exchanges to say
+int uart_link_remote_time(UARTLink *link, int64_t local, int64_t *remote);
+
+// angle in rad the controller turned through between local times t0 and t1, from its attitude messages
+// returns 1 if the history doesn't cover both times
+int uart_link_attitude_delta(UARTLink *link, int64_t t0, int64_t t1, double *angle);
+
+#endif
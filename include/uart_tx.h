@@ -0,0 +1,70 @@
+#ifndef UART_TX_H
+#define UART_TX_H
+
+#include <uart.h>
+#include <pose_packet.h>
+#include <timestamps.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define UART_TX_DEPTH 4 // packets waiting for the wire, a newer pose makes an older one worthless anyway
+#define UART_TX_POLL_MS 100 // how long the writer waits for the fd before checking whether it should exit
+
+// transmit side of the UART on its own thread, callers only copy a packet in and never wait on the device
+// when the link can't keep up the oldest queued packet is dropped for the new one
+typedef struct _UARTTx {
+    UARTInfo *uart;
+
+    uint8_t slots[UART_TX_DEPTH][POSE_PACKET_MAX];
+    size_t sizes[UART_TX_DEPTH];
+    uint32_t head; // next slot to write out
+    uint32_t count; // queued slots
+
+    // a ping goes out ahead of the queued poses and is never dropped for one
+    // it is only encoded on the writer thread, so its t1 is when it really reaches the driver
+    uint8_t ping_pending;
+    uint16_t ping_seq;
+
+    pthread_mutex_t lock; // only held to copy a packet in or out
+    pthread_cond_t ready;
+    pthread_t thread;
+    int running;
+
+    uint64_t queued; // packets handed to uart_tx_send
+    uint64_t sent; // packets written out in full
+    uint64_t dropped; // packets replaced by a newer one before they were written
+    uint64_t partial; // writes that took only part of what was left of a packet
+    uint64_t failed; // packets given up on after a write error
+
+    // link use, only touched by the writer thread
+    uint64_t bytes; // written to the driver
+    int64_t started; // us
+    int64_t report_us; // between utilization lines, 0 for only the summary at the end
+    int64_t window_start;
+    uint64_t window_bytes;
+    int64_t window_max_queue; // us
+    int64_t max_queue; // us, longest a packet's last byte waited in the driver's queue behind the ones before it
+    double queue_sum; // us, for the average
+    uint64_t queue_samples;
+} UARTTx;
+
+// starts the writer thread on an open UART, which prints the link's use every report_ms if that isn't 0
+int uart_tx_start(UARTTx *tx, UARTInfo *uart, int report_ms);
+
+// queues a copy of size bytes, returns 1 if an older packet was dropped to make room
+int uart_tx_send(UARTTx *tx, const uint8_t *data, size_t size);
+
+// queues a ping with seq, stamped and encoded by the writer just before it is written
+// a ping that hasn't gone out yet is replaced, only the newest seq gets an answer that counts
+int uart_tx_ping(UARTTx *tx, uint16_t seq);
+
+// stops and joins the writer, anything still queued is discarded
+int uart_tx_stop(UARTTx *tx);
+
+#endif
@@ -0,0 +1,51 @@
+#include <alloc_count.h>
+
+#ifdef ALLOC_ACCOUNTING
+
+// glibc's own entry points, the wrappers below take the place of malloc for the whole process
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+// per thread so every stage sees only its own, initial exec TLS never allocates itself
+static __thread uint64_t thread_allocs;
+
+void *malloc(size_t size) {
+    thread_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    thread_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    thread_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+uint64_t alloc_count_thread(void) {
+    return thread_allocs;
+}
+
+int alloc_count_enabled(void) {
+    return 1;
+}
+
+#else
+
+uint64_t alloc_count_thread(void) {
+    return 0;
+}
+
+int alloc_count_enabled(void) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include <clock_sync.h>
+
+void clock_sync_init(ClockSync *cs) {
+    memset(cs, 0, sizeof(ClockSync));
+}
+
+// least squares line through the samples whose delay is close to the quickest one
+// a slow exchange was held up on one leg or the other, so its offset is off by up to half the extra delay
+static void clock_sync_fit(ClockSync *cs) {
+    int64_t min_delay = INT64_MAX;
+    for (uint32_t i = 0; i < cs->count; i++) {
+        if (cs->samples[i].delay < min_delay) min_delay = cs->samples[i].delay;
+    }
+
+    // times and offsets relative to the first sample, their absolute values don't fit in a double's precision squared
+    const SyncSample *ref = &cs->samples[(cs->head + CLOCK_SYNC_WINDOW - cs->count) % CLOCK_SYNC_WINDOW];
+    double st = 0, so = 0;
+    int n = 0;
+
+    for (uint32_t i = 0; i < cs->count; i++) {
+        const SyncSample *s = &cs->samples[i];
+        if (s->delay > min_delay + CLOCK_SYNC_SLACK) continue;
+        st += s->t - ref->t;
+        so += s->offset - ref->offset;
+        n++;
+    }
+
+    double mt = st / n, mo = so / n;
+    double stt = 0, sto = 0;
+
+    for (uint32_t i = 0; i < cs->count; i++) {
+        const SyncSample *s = &cs->samples[i];
+        if (s->delay > min_delay + CLOCK_SYNC_SLACK) continue;
+        double dt = s->t - ref->t - mt;
+        stt += dt * dt;
+        sto += dt * (s->offset - ref->offset - mo);
+    }
+
+    // a window spanning next to no time says nothing about the drift
+    double drift = n >= 2 && stt > 1e6 ? sto / stt : 0;
+    if (drift > CLOCK_SYNC_MAX_DRIFT) drift = CLOCK_SYNC_MAX_DRIFT;
+    if (drift < -CLOCK_SYNC_MAX_DRIFT) drift = -CLOCK_SYNC_MAX_DRIFT;
+
+    cs->t0 = ref->t + (int64_t)mt;
+    cs->offset = ref->offset + mo;
+    cs->drift = drift;
+    cs->valid = cs->count >= CLOCK_SYNC_MIN_SAMPLES;
+}
+
+int clock_sync_add(ClockSync *cs, int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+    SyncSample s;
+    s.t = t1 + (t4 - t1) / 2;
+    s.offset = ((t2 - t1) + (t3 - t4)) / 2;
+    s.delay = (t4 - t1) - (t3 - t2);
+
+    cs->exchanges++;
+
+    // a reply from before the ping or one the remote side held longer than the round trip is garbage
+    if (s.delay < 0 || t4 < t1) {
+        cs->rejected++;
+        return 1;
+    }
+
+    int slow = 0;
+    if (cs->valid) {
+        int64_t min_delay = INT64_MAX;
+        for (uint32_t i = 0; i < cs->count; i++) {
+            if (cs->samples[i].delay < min_delay) min_delay = cs->samples[i].delay;
+        }
+        slow = s.delay > min_delay + CLOCK_SYNC_SLACK;
+    }
+
+    // kept either way, when the link gets slower for good the window moves on to the new delays
+    cs->samples[cs->head] = s;
+    cs->head = (cs->head + 1) % CLOCK_SYNC_WINDOW;
+    if (cs->count < CLOCK_SYNC_WINDOW) cs->count++;
+
+    if (slow) cs->rejected++;
+    clock_sync_fit(cs);
+
+    return slow;
+}
+
+int64_t clock_sync_to_remote(const ClockSync *cs, int64_t local) {
+    return local + (int64_t)(cs->offset + cs->drift * (local - cs->t0));
+}
+
+int64_t clock_sync_to_local(const ClockSync *cs, int64_t remote) {
+    // remote - offset(local) = local, solved for local
+    return cs->t0 + (int64_t)((remote - cs->t0 - cs->offset) / (1.0 + cs->drift));
+}
@@ -0,0 +1,138 @@
+#include <decoder_cache.h>
+
+static uint64_t codes_hash(apriltag_family_t *fam) {
+    // FNV-1a
+    uint64_t h = 1469598103934665603ULL;
+    const uint8_t *p = (const uint8_t *)fam->codes;
+
+    for (size_t i = 0; i < fam->ncodes * sizeof(uint64_t); i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h ^ fam->nbits;
+}
+
+static void cache_path(char *path, size_t len, const char *dir, apriltag_family_t *fam, int hamming) {
+    snprintf(path, len, "%s%s_h%d.qd", dir, fam->name, hamming);
+}
+
+static void cache_header(DecoderCacheHeader *hdr, apriltag_family_t *fam, int hamming, uint64_t nentries) {
+    memset(hdr, 0, sizeof(DecoderCacheHeader));
+    memcpy(hdr->magic, DECODER_CACHE_MAGIC, sizeof(hdr->magic));
+    strncpy(hdr->family, fam->name, sizeof(hdr->family) - 1);
+    hdr->nbits = fam->nbits;
+    hdr->ncodes = fam->ncodes;
+    hdr->hamming = hamming;
+    hdr->entry_size = sizeof(QuickDecodeEntry);
+    hdr->codes_hash = codes_hash(fam);
+    hdr->nentries = nentries;
+}
+
+int decoder_cache_load(DecoderCache *cache, const char *dir, apriltag_family_t *fam, int hamming) {
+    char path[FILENAME_MAX];
+    struct stat st;
+
+    memset(cache, 0, sizeof(DecoderCache));
+
+    // the family already has a table
+    if (fam->impl != NULL) return 1;
+
+    cache_path(path, sizeof(path), dir, fam, hamming);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 2;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DecoderCacheHeader)) {
+        close(fd);
+        return 3;
+    }
+
+    // read only and shared, every instance maps the same pages
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 4;
+
+    DecoderCacheHeader expected;
+    const DecoderCacheHeader *hdr = (const DecoderCacheHeader *)map;
+    cache_header(&expected, fam, hamming, hdr->nentries);
+
+    if (memcmp(hdr, &expected, sizeof(DecoderCacheHeader)) != 0 ||
+            (size_t)st.st_size != sizeof(DecoderCacheHeader) + hdr->nentries * sizeof(QuickDecodeEntry)) {
+        printf("Decoder cache %s doesn't match the family, rebuilding it\n", path);
+        munmap(map, st.st_size);
+        return 5;
+    }
+
+    cache->map = map;
+    cache->size = st.st_size;
+    cache->qd.nentries = (int)hdr->nentries;
+    cache->qd.entries = (QuickDecodeEntry *)((uint8_t *)map + sizeof(DecoderCacheHeader));
+    cache->loaded = 1;
+
+    // apriltag only ever reads the table
+    fam->impl = &cache->qd;
+
+    return 0;
+}
+
+int decoder_cache_store(const char *dir, apriltag_family_t *fam, int hamming) {
+    char path[FILENAME_MAX], tmp[FILENAME_MAX + 16];
+    QuickDecode *qd = (QuickDecode *)fam->impl;
+
+    if (qd == NULL) return 1;
+
+    mkdir(dir, 0755);
+
+    cache_path(path, sizeof(path), dir, fam, hamming);
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    // a unique name per writer, detectors in other processes or containers may share the pid
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror("Decoder cache: couldn't create the file");
+        return 2;
+    }
+
+    // mkstemp creates it private, the cache is shared like the rest of the directory
+    fchmod(fd, 0644);
+
+    FILE *file = fdopen(fd, "wb");
+    if (file == NULL) {
+        perror("Decoder cache: couldn't open the file");
+        close(fd);
+        unlink(tmp);
+        return 2;
+    }
+
+    DecoderCacheHeader hdr;
+    cache_header(&hdr, fam, hamming, qd->nentries);
+
+    size_t written = fwrite(&hdr, sizeof(hdr), 1, file);
+    written += fwrite(qd->entries, sizeof(QuickDecodeEntry), qd->nentries, file);
+
+    if (fclose(file) != 0 || written != 1 + (size_t)qd->nentries) {
+        perror("Decoder cache: write failed");
+        unlink(tmp);
+        return 3;
+    }
+
+    // a reader never sees a partly written table, and concurrent writers all write the same one
+    if (rename(tmp, path) != 0) {
+        perror("Decoder cache: rename failed");
+        unlink(tmp);
+        return 4;
+    }
+
+    return 0;
+}
+
+void decoder_cache_release(DecoderCache *cache, apriltag_family_t *fam) {
+    if (!cache->loaded) return;
+
+    if (fam->impl == &cache->qd) fam->impl = NULL;
+    munmap(cache->map, cache->size);
+
+    cache->map = NULL;
+    cache->loaded = 0;
+}
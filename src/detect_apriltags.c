@@ -5,6 +5,7 @@
 int apriltag_setup(apriltag_detector_t **td, 
         apriltag_family_t **tf, 
         apriltag_detection_info_t *info,
+        DecoderCache *cache,
         Settings *settings) {
     *td = apriltag_detector_create();
 
@@ -41,6 +42,14 @@ int apriltag_setup(apriltag_detector_t **td,
             return 1;
     }
 
+    // a cached decode table makes add_family_bits skip building its own, which takes seconds at hamming 2 or 3
+    uint8_t use_cache = settings->decoder_cache[0] != '\0';
+    memset(cache, 0, sizeof(DecoderCache));
+    if (use_cache && decoder_cache_load(cache, settings->decoder_cache, *tf, settings->hamming) == 0) {
+        printf("Loaded the %s decode table from the cache\n", (*tf)->name);
+    }
+
+    errno = 0;
     apriltag_detector_add_family_bits(*td, *tf, settings->hamming);
 
     switch(errno){
@@ -52,6 +61,10 @@ int apriltag_setup(apriltag_detector_t **td,
             exit(-1);
     }
 
+    if (use_cache && !cache->loaded) {
+        decoder_cache_store(settings->decoder_cache, *tf, settings->hamming);
+    }
+
     (*td)->debug = settings->debug;
     (*td)->nthreads = settings->threads;
     (*td)->quad_decimate = settings->dec;
@@ -67,42 +80,86 @@ int apriltag_setup(apriltag_detector_t **td,
     return 0;
 }
 
+// searches only the regions the tracker predicts tags in, falls back to the whole frame when it has none
+// or when a tracked tag wasn't found in its region
+static zarray_t *apriltag_detect_tracked(apriltag_detector_t *td, image_u8_t *im, ROITracker *tracker, int64_t t) {
+    ROI rois[MAX_TRACKED];
+    int nrois = roi_tracker_plan(tracker, t, im->width, im->height, rois);
+
+    if (nrois > 0) {
+        zarray_t *det = zarray_create(sizeof(apriltag_detection_t *));
+
+        for (int i = 0; i < nrois; i++) {
+            // a view into the frame, same stride, nothing is copied
+            image_u8_t view = {
+                .width = rois[i].x1 - rois[i].x0,
+                .height = rois[i].y1 - rois[i].y0,
+                .stride = im->stride,
+                .buf = im->buf + rois[i].y0 * im->stride + rois[i].x0
+            };
+            image_u8_t sub;
+            memcpy(&sub, &view, sizeof(image_u8_t));
+
+            zarray_t *found = apriltag_detector_detect(td, &sub);
+
+            for (int j = 0; j < zarray_size(found); j++) {
+                apriltag_detection_t *d;
+                zarray_get(found, j, &d);
+                roi_shift_detection(d, rois[i].x0, rois[i].y0);
+                zarray_add(det, &d);
+            }
+
+            // only the array, the detections moved to det
+            zarray_destroy(found);
+        }
+
+        if (roi_tracker_missing(tracker, det) == 0) {
+            roi_tracker_update(tracker, det, t, 0);
+            return det;
+        }
+
+        apriltag_detections_destroy(det);
+    }
+
+    zarray_t *det = apriltag_detector_detect(td, im);
+    roi_tracker_update(tracker, det, t, 1);
+
+    return det;
+}
+
 int apriltag_detect(apriltag_detector_t *td,
-        uint8_t *imdata, 
+        image_u8_t *im, 
         apriltag_detection_info_t *info, 
         apriltag_pose_t *poses,
         Settings *settings,
+        ROITracker *tracker,
+        PoseTracker *warm,
+        TagMap *map,
         int *ids,
-        uint8_t *nids) {
-    // loop through iterations
-    image_u8_t *im = NULL;
+        uint8_t *nids,
+        double *err,
+        StageTimes *times,
+        int worker) {
+    times->detect_start = monotonic_us();
 
+    // loop through iterations, im is a view of the captured frame and is never copied
     for (uint8_t i = 0; i < settings->iterations; i++) {
         int total_quads = 0;
         double total_time = 0;
 
-        im = image_u8_create(settings->width, settings->height);
-        
-        // copy captured image to the buffer, this accomodates extra row space in im
-        for (int i = 0; i < settings->height; i++) {
-            uint8_t* row_d = im->buf + i * im->stride;
-            uint8_t* row_s = imdata + i * settings->width;
-            memcpy(row_d, row_s, settings->width);
-        }
-
-        // write the current image buffer to a file
+        // write the current image buffer to a file, one per detector instance so they don't write over each other
         if (td->debug) {
-            char path[100];
-            strcpy(path, settings->output_directory);
-            strcat(path, "debug.pnm");
-            printf(path);
-            printf("\n");
+            char path[PLEN + 32];
+            snprintf(path, sizeof(path), "%sdebug%d.pnm", settings->output_directory, worker);
+            printf("%s\n", path);
 
             image_u8_write_pnm(im, path);
         }
 
-        // get detections
-        zarray_t *det = apriltag_detector_detect(td, im);
+        // get detections, in full frame coordinates either way
+        zarray_t *det;
+        if (tracker != NULL) det = apriltag_detect_tracked(td, im, tracker, times->capture);
+        else det = apriltag_detector_detect(td, im);
 
         if (errno == EAGAIN) {
             printf("Unable to create the %d threads requested.\n", td->nthreads);
@@ -110,29 +167,51 @@ int apriltag_detect(apriltag_detector_t *td,
         }
 
         // loop through detections, every d* is a tag detected in the image
-        (*nids) = zarray_size(det);
+        // tags that aren't in the map can't give a position, so they are left out
+        apriltag_detection_t *dets[MAX_DETECTIONS];
+        (*nids) = 0;
 
-        if ((*nids) == 0) {
-            if (!settings->quiet) printf("No detections.\n");
-            zarray_destroy(det);
-            image_u8_destroy(im);
-            return 3;
-        }
-
-        for (int j = 0; j < (*nids); j++) {
-            static apriltag_detection_t *d;
+        for (int j = 0; j < zarray_size(det) && (*nids) < MAX_DETECTIONS; j++) {
+            apriltag_detection_t *d;
             zarray_get(det, j, &d);
 
             if (!settings->quiet)
                 printf("detection %3d: id (%2dx%2d)-%-4d, hamming %d, margin %8.3f\n",
                         j, d->family->nbits, d->family->h, d->id, d->hamming, d->decision_margin);
-            
-            (*info).det = d;
 
-            ids[j] = d->id;
+            if (tag_map_get(map, d->id) == NULL) continue;
+
+            dets[*nids] = d;
+            ids[*nids] = d->id;
+            (*nids)++;
+        }
+
+        if ((*nids) == 0) {
+            if (!settings->quiet) printf("No detections.\n");
+            apriltag_detections_destroy(det);
+            times->detect_end = monotonic_us();
+            return 3;
+        }
+
+        // with more than one tag, solve a single camera pose over all their corners using the grid layout
+        double joint_err = -1;
+        if (settings->joint_pose && (*nids) > 1) {
+            joint_err = grid_pose_estimate(info, dets, *nids, map, warm, times->capture, poses);
+            if (!settings->quiet) {
+                if (joint_err < 0) printf("Joint pose of %d tags rejected, solving each tag\n", *nids);
+                else printf("Joint pose of %d tags, reprojection error %.3f px\n", *nids, joint_err);
+            }
+        }
+        *err = joint_err;
 
+        for (int j = 0; j < (*nids); j++) {
             // get the pose (vector is cetered at cam center and points toward the tag center)
-            double err = estimate_tag_pose(info, &poses[j]);
+            if (joint_err < 0) {
+                double tag_err = tag_pose_estimate(warm, info, dets[j], times->capture, &poses[j]);
+
+                // the first tag's pose is the one transformed into the map
+                if (j == 0) *err = tag_err;
+            }
 
             if (!settings->quiet) {
                 printf("Rotation matrix R for tag id: %d = \n{%2.2f, %2.2f, %2.2f\n %2.2f, %2.2f, %2.2f\n %2.2f, %2.2f, %2.2f\n",
@@ -156,18 +235,22 @@ int apriltag_detect(apriltag_detector_t *td,
             printf("Time: %12.3f \n", t);
         }
 
-        zarray_destroy(det);
-        image_u8_destroy(im);
+        apriltag_detections_destroy(det);
     }
 
+    times->detect_end = monotonic_us();
+
     return 0;
 }
 
 int apriltag_cleanup(apriltag_detector_t **td, 
         apriltag_family_t **tf, 
-        apriltag_detection_info_t *info) {
-    tagStandard41h12_destroy(*tf);
+        apriltag_detection_info_t *info,
+        DecoderCache *cache) {
+    // the detector frees the family's decode table, so a mapped one has to be taken back first
+    decoder_cache_release(cache, *tf);
     apriltag_detector_destroy(*td);
+    tagStandard41h12_destroy(*tf);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include <detect_tuner.h>
+
+// decimation factors from finest to coarsest
+static const float ladder[] = { 1.0f, 1.5f, 2.0f, 3.0f, 4.0f, 6.0f, 8.0f };
+#define NLEVELS ((int)(sizeof(ladder) / sizeof(ladder[0])))
+
+int tuner_init(DetectTuner *tuner, apriltag_detector_t *td, Settings *settings) {
+    memset(tuner, 0, sizeof(DetectTuner));
+
+    tuner->budget = settings->detect_budget_us;
+    tuner->fx = settings->fx;
+    tuner->tag_size = settings->tag_size;
+
+    tuner->min_level = 0;
+    while (tuner->min_level < NLEVELS - 1 && ladder[tuner->min_level] < settings->dec_min) tuner->min_level++;
+
+    tuner->max_level = NLEVELS - 1;
+    while (tuner->max_level > tuner->min_level && ladder[tuner->max_level] > settings->dec_max) tuner->max_level--;
+
+    // start at the configured decimation, or the closest the ladder allows
+    tuner->level = tuner->min_level;
+    while (tuner->level < tuner->max_level && ladder[tuner->level] < settings->dec) tuner->level++;
+
+    td->quad_decimate = ladder[tuner->level];
+
+    return 0;
+}
+
+// coarsest level at which the smallest expected tag still has enough pixels to be found
+static int tuner_size_level(DetectTuner *tuner) {
+    int level = tuner->max_level;
+    if (tuner->tag_px <= 0) return level;
+
+    while (level > tuner->min_level && tuner->tag_px / ladder[level] < TUNE_MIN_TAG_PX) level--;
+
+    return level;
+}
+
+static void tuner_set_level(DetectTuner *tuner, apriltag_detector_t *td, int level) {
+    // detection time goes roughly with the number of decimated pixels
+    double ratio = ladder[tuner->level] / ladder[level];
+    tuner->avg *= ratio * ratio;
+
+    tuner->level = level;
+    tuner->hold = TUNE_HOLD_FRAMES;
+    tuner->changes++;
+
+    td->quad_decimate = ladder[level];
+}
+
+int tuner_update(DetectTuner *tuner, apriltag_detector_t *td, apriltag_pose_t *poses, uint8_t nids, int status, int64_t detect_time) {
+    if (tuner->avg == 0) tuner->avg = detect_time;
+    else tuner->avg += TUNE_EWMA * (detect_time - tuner->avg);
+
+    // the farthest tag is the smallest one in the image
+    if (status == 0 && nids > 0) {
+        tuner->lost = 0;
+        tuner->tag_px = 0;
+
+        for (int i = 0; i < nids; i++) {
+            double z = poses[i].t->data[2];
+            if (z <= 0) continue;
+
+            double px = tuner->fx * tuner->tag_size / z;
+            if (tuner->tag_px == 0 || px < tuner->tag_px) tuner->tag_px = px;
+        }
+    }
+    else if (tuner->lost < TUNE_LOST_FRAMES) {
+        tuner->lost++;
+    }
+
+    int size_level = tuner_size_level(tuner);
+
+    // without tags for a while, search at full detail until they are found again
+    if (tuner->lost >= TUNE_LOST_FRAMES) {
+        tuner->tag_px = 0;
+        size_level = tuner->min_level;
+    }
+
+    if (tuner->level > size_level) {
+        // tags are about to get too small to find, that can't wait for the hold
+        tuner_set_level(tuner, td, size_level);
+    }
+    else if (tuner->hold > 0) {
+        tuner->hold--;
+    }
+    else if (tuner->avg > tuner->budget * (1 + TUNE_HYSTERESIS) && tuner->level < size_level) {
+        tuner_set_level(tuner, td, tuner->level + 1);
+    }
+    else if (tuner->avg < tuner->budget * (1 - TUNE_HYSTERESIS) && tuner->level > tuner->min_level) {
+        // only go finer if the expected time there still fits, otherwise the next frame would step right back
+        double ratio = ladder[tuner->level] / ladder[tuner->level - 1];
+        if (tuner->avg * ratio * ratio < tuner->budget) tuner_set_level(tuner, td, tuner->level - 1);
+    }
+
+    // clusters much shorter than a tag's border are noise, skipping them saves quad fitting
+    // an eighth of the expected decimated perimeter leaves room for partly hidden tags
+    int cluster = TUNE_MIN_CLUSTER;
+    if (tuner->tag_px > 0) {
+        int px = (int)(tuner->tag_px / ladder[tuner->level] / 2);
+        if (px > cluster) cluster = px;
+    }
+
+    int current = td->qtp.min_cluster_pixels;
+    if (abs(cluster - current) > TUNE_CLUSTER_CHANGE * current) td->qtp.min_cluster_pixels = cluster;
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <flight_log.h>
+
+static int flusher_running(FlightLog *fl) {
+    return __atomic_load_n(&fl->running, __ATOMIC_ACQUIRE);
+}
+
+// msyncs the pages holding records synced..head, and the header with the head itself
+static void flight_log_sync(FlightLog *fl) {
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t head = __atomic_load_n(&fl->header->head, __ATOMIC_ACQUIRE);
+    uint64_t capacity = fl->header->capacity;
+
+    if (head == fl->synced) return;
+
+    // more than a lap behind, only the last lap is still in the file
+    uint64_t from = head - fl->synced > capacity ? head - capacity : fl->synced;
+
+    while (from < head) {
+        uint64_t slot = from % capacity;
+        uint64_t n = capacity - slot < head - from ? capacity - slot : head - from; // up to the end of the ring
+
+        size_t start = FLIGHT_LOG_DATA_OFFSET + slot * sizeof(LogRecord);
+        size_t end = start + n * sizeof(LogRecord);
+        start -= start % page;
+        msync(fl->map + start, end - start, MS_SYNC);
+
+        from += n;
+    }
+
+    msync(fl->map, page, MS_SYNC);
+    fl->synced = head;
+}
+
+static void *flusher_thread(void *arg) {
+    FlightLog *fl = (FlightLog *)arg;
+
+    while (flusher_running(fl)) {
+        usleep(fl->sync_us);
+        flight_log_sync(fl);
+    }
+
+    return NULL;
+}
+
+int flight_log_open(FlightLog *fl, const char *path, uint64_t capacity, uint32_t options, int sync_ms) {
+    memset(fl, 0, sizeof(FlightLog));
+    if (capacity < 1) capacity = 1;
+
+    fl->fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fl->fd == -1) {
+        perror("Failed to open the flight log");
+        return -1;
+    }
+
+    // the blocks are allocated now, so a full disk shows up here and not as SIGBUS in the middle of a run
+    fl->map_size = FLIGHT_LOG_DATA_OFFSET + capacity * sizeof(LogRecord);
+    int ec = posix_fallocate(fl->fd, 0, fl->map_size);
+    if (ec != 0) {
+        fprintf(stderr, "Failed to allocate the flight log: %s\n", strerror(ec));
+        close(fl->fd);
+        return -2;
+    }
+
+    // populated up front, the first lap doesn't take a page fault per page
+    fl->map = (uint8_t *)mmap(NULL, fl->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fl->fd, 0);
+    if (fl->map == MAP_FAILED) {
+        perror("Failed to map the flight log");
+        close(fl->fd);
+        return -3;
+    }
+
+    fl->header = (FlightLogHeader *)fl->map;
+    fl->records = (LogRecord *)(fl->map + FLIGHT_LOG_DATA_OFFSET);
+
+    memcpy(fl->header->magic, FLIGHT_LOG_MAGIC, sizeof(fl->header->magic));
+    fl->header->record_size = sizeof(LogRecord);
+    fl->header->options = options;
+    fl->header->capacity = capacity;
+    fl->header->head = 0;
+
+    fl->sync_us = (int64_t)sync_ms * 1000;
+    if (fl->sync_us > 0) {
+        fl->running = 1;
+        if (pthread_create(&fl->flusher, NULL, flusher_thread, fl) != 0) {
+            perror("Flight log flusher thread creation failed");
+            fl->running = 0;
+        }
+    }
+
+    return 0;
+}
+
+int flight_log_close(FlightLog *fl) {
+    if (fl->running) {
+        __atomic_store_n(&fl->running, 0, __ATOMIC_RELEASE);
+        pthread_join(fl->flusher, NULL);
+    }
+
+    flight_log_sync(fl);
+
+    munmap(fl->map, fl->map_size);
+    if (close(fl->fd) == -1) {
+        perror("Failed to close the flight log");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,378 @@
+#include <grid_pose.h>
+
+// corners of a tag in its own frame, in the order of det->p, same as estimate_tag_pose uses
+static void tag_corners(double s, double X[4][3]) {
+    double h = s / 2;
+    double c[4][3] = { { -h, h, 0 }, { h, h, 0 }, { h, -h, 0 }, { -h, -h, 0 } };
+    memcpy(X, c, sizeof(c));
+}
+
+// rotation by angle |w| around w
+static void rodrigues(const double w[3], double R[9]) {
+    double th = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+    double k[3] = { 0, 0, 0 };
+    double s = th, c = 0;
+
+    if (th > 1e-12) {
+        k[0] = w[0] / th;
+        k[1] = w[1] / th;
+        k[2] = w[2] / th;
+        s = sin(th);
+        c = 1 - cos(th);
+    }
+    else {
+        // first order, I + [w]x
+        k[0] = w[0];
+        k[1] = w[1];
+        k[2] = w[2];
+        s = 1;
+    }
+
+    R[0] = 1 - c * (k[1] * k[1] + k[2] * k[2]);
+    R[1] = -s * k[2] + c * k[0] * k[1];
+    R[2] = s * k[1] + c * k[0] * k[2];
+    R[3] = s * k[2] + c * k[0] * k[1];
+    R[4] = 1 - c * (k[0] * k[0] + k[2] * k[2]);
+    R[5] = -s * k[0] + c * k[1] * k[2];
+    R[6] = -s * k[1] + c * k[0] * k[2];
+    R[7] = s * k[0] + c * k[1] * k[2];
+    R[8] = 1 - c * (k[0] * k[0] + k[1] * k[1]);
+}
+
+// solves the 6x6 system A x = b in place with partial pivoting, returns nonzero if it is singular
+static int solve6(double A[36], double b[6], double x[6]) {
+    for (int i = 0; i < 6; i++) {
+        int piv = i;
+        for (int r = i + 1; r < 6; r++) {
+            if (fabs(A[r * 6 + i]) > fabs(A[piv * 6 + i])) piv = r;
+        }
+        if (fabs(A[piv * 6 + i]) < 1e-12) return 1;
+
+        if (piv != i) {
+            for (int c = 0; c < 6; c++) {
+                double tmp = A[i * 6 + c];
+                A[i * 6 + c] = A[piv * 6 + c];
+                A[piv * 6 + c] = tmp;
+            }
+            double tmp = b[i];
+            b[i] = b[piv];
+            b[piv] = tmp;
+        }
+
+        for (int r = i + 1; r < 6; r++) {
+            double f = A[r * 6 + i] / A[i * 6 + i];
+            for (int c = i; c < 6; c++) A[r * 6 + c] -= f * A[i * 6 + c];
+            b[r] -= f * b[i];
+        }
+    }
+
+    for (int i = 5; i >= 0; i--) {
+        double s = b[i];
+        for (int c = i + 1; c < 6; c++) s -= A[i * 6 + c] * x[c];
+        x[i] = s / A[i * 6 + i];
+    }
+
+    return 0;
+}
+
+static double tag_area(apriltag_detection_t *d) {
+    double a = 0;
+    for (int i = 0; i < 4; i++) {
+        int j = (i + 1) % 4;
+        a += d->p[i][0] * d->p[j][1] - d->p[j][0] * d->p[i][1];
+    }
+
+    return fabs(a) / 2;
+}
+
+// one Gauss-Newton pass over every corner, fills the normal equations and returns the squared error
+// the rotation is perturbed on the left, R' = exp([w]x) R, so dXc/dw = -[R X]x and dXc/dt = I
+static double grid_pose_normal(apriltag_detection_info_t *info, apriltag_detection_t **dets, int n, double (*obj)[4][3],
+        const double R[9], const double t[3], double A[36], double b[6]) {
+    double err = 0;
+
+    memset(A, 0, 36 * sizeof(double));
+    memset(b, 0, 6 * sizeof(double));
+
+    for (int j = 0; j < n; j++) {
+        for (int k = 0; k < 4; k++) {
+            const double *X = obj[j][k];
+            double RX[3] = {
+                R[0] * X[0] + R[1] * X[1] + R[2] * X[2],
+                R[3] * X[0] + R[4] * X[1] + R[5] * X[2],
+                R[6] * X[0] + R[7] * X[1] + R[8] * X[2]
+            };
+            double Xc[3] = { RX[0] + t[0], RX[1] + t[1], RX[2] + t[2] };
+
+            // behind the camera, nothing sensible to linearize
+            if (Xc[2] < 1e-6) continue;
+
+            double iz = 1 / Xc[2];
+            double ru = info->fx * Xc[0] * iz + info->cx - dets[j]->p[k][0];
+            double rv = info->fy * Xc[1] * iz + info->cy - dets[j]->p[k][1];
+            err += ru * ru + rv * rv;
+
+            double du[3] = { info->fx * iz, 0, -info->fx * Xc[0] * iz * iz };
+            double dv[3] = { 0, info->fy * iz, -info->fy * Xc[1] * iz * iz };
+
+            // -[RX]x by rows
+            double M[3][3] = {
+                { 0, RX[2], -RX[1] },
+                { -RX[2], 0, RX[0] },
+                { RX[1], -RX[0], 0 }
+            };
+
+            double Ju[6], Jv[6];
+            for (int c = 0; c < 3; c++) {
+                Ju[c] = du[0] * M[0][c] + du[1] * M[1][c] + du[2] * M[2][c];
+                Jv[c] = dv[0] * M[0][c] + dv[1] * M[1][c] + dv[2] * M[2][c];
+                Ju[c + 3] = du[c];
+                Jv[c + 3] = dv[c];
+            }
+
+            for (int r = 0; r < 6; r++) {
+                for (int c = 0; c < 6; c++) A[r * 6 + c] += Ju[r] * Ju[c] + Jv[r] * Jv[c];
+                b[r] -= Ju[r] * ru + Jv[r] * rv;
+            }
+        }
+    }
+
+    return err;
+}
+
+// Gauss-Newton on R and t in place, stops once a step is negligible, returns the RMS reprojection error in pixels
+static double pose_refine(apriltag_detection_info_t *info, apriltag_detection_t **dets, int n, double (*obj)[4][3],
+        double R[9], double t[3], int iterations) {
+    double A[36], b[6], x[6], err = 0;
+
+    for (int it = 0; it < iterations; it++) {
+        grid_pose_normal(info, dets, n, obj, R, t, A, b);
+        if (solve6(A, b, x)) break;
+
+        double dR[9], Rn[9];
+        rodrigues(x, dR);
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                Rn[r * 3 + c] = dR[r * 3] * R[c] + dR[r * 3 + 1] * R[3 + c] + dR[r * 3 + 2] * R[6 + c];
+            }
+        }
+        memcpy(R, Rn, sizeof(Rn));
+        t[0] += x[3];
+        t[1] += x[4];
+        t[2] += x[5];
+
+        double step = 0;
+        for (int i = 0; i < 6; i++) step += x[i] * x[i];
+        if (step < GRID_POSE_STEP_EPS) break;
+    }
+    err = grid_pose_normal(info, dets, n, obj, R, t, A, b);
+
+    return sqrt(err / (4 * n));
+}
+
+int pose_tracker_init(PoseTracker *pt, Settings *settings) {
+    memset(pt, 0, sizeof(PoseTracker));
+    pt->max_jump = settings->warm_max_jump;
+
+    return 0;
+}
+
+static TrackedPose *pose_tracker_find(PoseTracker *pt, int id, int64_t time) {
+    for (int i = 0; i < pt->ntags; i++) {
+        if (pt->tags[i].id == id) return time - pt->tags[i].time <= POSE_WARM_MAX_AGE ? &pt->tags[i] : NULL;
+    }
+
+    return NULL;
+}
+
+// keeps the pose for the next frame, the stalest entry makes room when it is full
+static void pose_tracker_store(PoseTracker *pt, TrackedPose *entry, int id, const double R[9], const double t[3], int64_t time) {
+    if (entry == NULL) {
+        for (int i = 0; i < pt->ntags; i++) {
+            if (pt->tags[i].id == id) entry = &pt->tags[i];
+        }
+    }
+
+    if (entry == NULL && pt->ntags < POSE_TRACKED_MAX) entry = &pt->tags[pt->ntags++];
+
+    if (entry == NULL) {
+        entry = &pt->tags[0];
+        for (int i = 1; i < pt->ntags; i++) {
+            if (pt->tags[i].time < entry->time) entry = &pt->tags[i];
+        }
+    }
+
+    entry->id = id;
+    entry->time = time;
+    memcpy(entry->R, R, sizeof(entry->R));
+    memcpy(entry->t, t, sizeof(entry->t));
+}
+
+// refines a copy of a previous pose, returns 0 if it converged close to where it started
+// err gets the RMS reprojection error in pixels
+static int pose_warm(PoseTracker *pt, apriltag_detection_info_t *info, apriltag_detection_t **dets, int n, double (*obj)[4][3],
+        TrackedPose *prev, double R[9], double t[3], double *err_out) {
+    memcpy(R, prev->R, 9 * sizeof(double));
+    memcpy(t, prev->t, 3 * sizeof(double));
+
+    double err = pose_refine(info, dets, n, obj, R, t, POSE_WARM_ITERATIONS);
+    *err_out = err;
+
+    double dt[3] = { t[0] - prev->t[0], t[1] - prev->t[1], t[2] - prev->t[2] };
+    double jump = sqrt(dt[0] * dt[0] + dt[1] * dt[1] + dt[2] * dt[2]);
+
+    // a large jump or a bad fit means the seed was in the wrong place, solve cold instead
+    if (err < 0 || err > POSE_WARM_MAX_ERROR || jump > pt->max_jump) return 1;
+
+    pt->warm++;
+    return 0;
+}
+
+// the caller's matrices are reused from frame to frame, only copied into
+static void pose_write(apriltag_pose_t *pose, const double R[9], const double t[3]) {
+    memcpy(pose->R->data, R, 9 * sizeof(double));
+    memcpy(pose->t->data, t, 3 * sizeof(double));
+}
+
+// estimate_tag_pose always creates new matrices, so its result is moved into the caller's
+// its error is in object space, so the pixel error is worked out here to match the other solves
+static double pose_cold(apriltag_detection_info_t *info, apriltag_pose_t *pose) {
+    apriltag_pose_t tmp;
+    double obj[1][4][3], A[36], b[6];
+
+    estimate_tag_pose(info, &tmp);
+
+    pose_write(pose, tmp.R->data, tmp.t->data);
+    matd_destroy(tmp.R);
+    matd_destroy(tmp.t);
+
+    tag_corners(info->tagsize, obj[0]);
+    return sqrt(grid_pose_normal(info, &info->det, 1, obj, pose->R->data, pose->t->data, A, b) / 4);
+}
+
+double tag_pose_estimate(PoseTracker *pt, apriltag_detection_info_t *info, apriltag_detection_t *det, int64_t time, apriltag_pose_t *pose) {
+    info->det = det;
+    if (pt == NULL) return pose_cold(info, pose);
+
+    double obj[1][4][3];
+    tag_corners(info->tagsize, obj[0]);
+
+    double R[9], t[3];
+    TrackedPose *prev = pose_tracker_find(pt, det->id, time);
+    double err;
+
+    if (prev != NULL && pose_warm(pt, info, &det, 1, obj, prev, R, t, &err) == 0) {
+        pose_write(pose, R, t);
+        pose_tracker_store(pt, prev, det->id, R, t, time);
+        return err;
+    }
+
+    // new tag or lost track, orthogonal iteration on both ambiguity branches
+    err = pose_cold(info, pose);
+    pt->cold++;
+    pose_tracker_store(pt, prev, det->id, pose->R->data, pose->t->data, time);
+
+    return err;
+}
+
+double grid_pose_estimate(apriltag_detection_info_t *info, apriltag_detection_t **dets, int n, TagMap *map,
+        PoseTracker *pt, int64_t time, apriltag_pose_t *poses) {
+    double obj[GRID_POSE_MAX_TAGS][4][3];
+    const TagPose *tags[GRID_POSE_MAX_TAGS];
+    Vec3 d[GRID_POSE_MAX_TAGS];
+
+    if (n < 1 || n > GRID_POSE_MAX_TAGS) return -1;
+
+    int ref = 0;
+    for (int j = 0; j < n; j++) {
+        tags[j] = tag_map_get(map, dets[j]->id);
+        if (tags[j] == NULL) return -1;
+
+        if (tag_area(dets[j]) > tag_area(dets[ref])) ref = j;
+    }
+
+    // the solve's frame is the map's moved to the largest tag's center, X = R_j X_tag + (t_j - t_ref)
+    // that way every tag's pose gives the same pose_transform output, and the points stay near the origin
+    // however far across the field they are
+    double corners[4][3];
+    tag_corners(info->tagsize, corners);
+
+    const Vec3 *origin = &tags[ref]->t;
+    for (int j = 0; j < n; j++) {
+        d[j] = vec3_sub(&tags[j]->t, origin);
+
+        for (int k = 0; k < 4; k++) {
+            Vec3 corner = vec3_from_array(corners[k]);
+            Vec3 X = mat3_mul_vec3(&tags[j]->R, &corner);
+            for (int c = 0; c < 3; c++) obj[j][k][c] = X.v[c] + d[j].v[c];
+        }
+    }
+
+    double R[9], t[3], err;
+    int cold = 1;
+
+    // the camera pose in the map is the same whichever tags are visible, so the last one seeds any set of tags
+    // it is kept relative to the map's origin, t = t_local - R t_ref
+    if (pt != NULL && pt->has_grid && time - pt->grid.time <= POSE_WARM_MAX_AGE) {
+        TrackedPose local = pt->grid;
+        for (int r = 0; r < 3; r++) {
+            local.t[r] += local.R[r * 3 + 0] * origin->v[0] + local.R[r * 3 + 1] * origin->v[1] + local.R[r * 3 + 2] * origin->v[2];
+        }
+
+        cold = pose_warm(pt, info, dets, n, obj, &local, R, t, &err);
+    }
+
+    if (cold) {
+        // the largest tag gives the most reliable single tag pose to start from, it sits at the origin
+        apriltag_pose_t seed;
+        info->det = dets[ref];
+        estimate_tag_pose(info, &seed);
+
+        // R = R_seed R_ref^T, t = t_seed
+        Mat3 Rs = mat3_from_array(seed.R->data);
+        Mat3 RwT = mat3_transpose(&tags[ref]->R);
+        Mat3 R0 = mat3_mul(&Rs, &RwT);
+        memcpy(R, R0.m, sizeof(R));
+        memcpy(t, seed.t->data, sizeof(t));
+        matd_destroy(seed.R);
+        matd_destroy(seed.t);
+
+        pose_refine(info, dets, n, obj, R, t, GRID_POSE_ITERATIONS);
+        if (pt != NULL) pt->cold++;
+    }
+    // no steps, only the error of the final pose
+    err = pose_refine(info, dets, n, obj, R, t, 0);
+
+    // a map that doesn't match where the tags really are can't be fit by one pose,
+    // the caller falls back to each tag's own solve and the bad pose isn't kept to start from
+    if (err < 0 || err > GRID_POSE_MAX_ERROR) {
+        if (pt != NULL) {
+            pt->has_grid = 0;
+            pt->rejected++;
+        }
+        return -1;
+    }
+
+    if (pt != NULL) {
+        pt->grid.id = -1;
+        pt->grid.time = time;
+        memcpy(pt->grid.R, R, sizeof(R));
+        for (int r = 0; r < 3; r++) {
+            pt->grid.t[r] = t[r] - (R[r * 3 + 0] * origin->v[0] + R[r * 3 + 1] * origin->v[1] + R[r * 3 + 2] * origin->v[2]);
+        }
+        pt->has_grid = 1;
+    }
+
+    // each tag's own pose is the joint one moved to its center, R_j = R R_w, t_j = t + R d_j
+    Mat3 Rj = mat3_from_array(R);
+    for (int j = 0; j < n; j++) {
+        Mat3 Rt = mat3_mul(&Rj, &tags[j]->R);
+        memcpy(poses[j].R->data, Rt.m, sizeof(Rt.m));
+
+        for (int r = 0; r < 3; r++) {
+            poses[j].t->data[r] = t[r] + R[r * 3 + 0] * d[j].v[0] + R[r * 3 + 1] * d[j].v[1] + R[r * 3 + 2] * d[j].v[2];
+        }
+    }
+
+    return err;
+}
@@ -1,29 +1,15 @@
 #include <gstream_from_cam.h>
 
-int gstream_setup(StreamSet *ss, Settings *settings, uint8_t emit_signals, uint8_t sync) {
-
-    // create the pipeline and elements to add to it
-    ss->pipeline = gst_pipeline_new("pipeline");
-
-    ss->source = gst_element_factory_make("libcamerasrc", "source");
-    ss->caps = gst_element_factory_make("capsfilter", "caps");
-    ss->queue = gst_element_factory_make("queue", "queue");
+// builds source -> caps -> queue -> convert -> scale -> sink, the sensor gives full HD BGRx which is converted to gray
+static int gstream_build_convert(StreamSet *ss, Settings *settings) {
     ss->convert = gst_element_factory_make("videoconvert", "convert");
     ss->scale = gst_element_factory_make("videoscale", "scale");
-    ss->sink = gst_element_factory_make("appsink", "sink");
 
-    // check if things were created correctly
-    if (!ss->pipeline || !ss->queue || !ss->source || !ss->caps || !ss->convert || !ss->scale || !ss->sink) {
+    if (!ss->convert || !ss->scale) {
         g_printerr("Not all elements could be created.\n");
         return 1;
     }
 
-    // set data to objects, customize filters
-    g_object_set(ss->sink,
-        "emit-signals", emit_signals, 
-        "sync", sync, 
-        NULL);
-    
     // caps filter for setting the output image parameters 
     // #TODO: add format options
     GstCaps *capssrc = gst_caps_new_simple(
@@ -50,36 +36,406 @@ int gstream_setup(StreamSet *ss, Settings *settings, uint8_t emit_signals, uint8
     gst_bin_add_many(GST_BIN (ss->pipeline), ss->source, ss->caps, ss->queue, ss->convert, ss->scale, ss->sink, NULL);
     if (!gst_element_link_many(ss->source, ss->caps, ss->queue, ss->convert, ss->scale, ss->sink, NULL)) {
         g_printerr("Elements could not be linked.\n");
-        gst_object_unref(ss->pipeline);
         return 2;
     }
 
+    ss->mode = CAPTURE_CONVERT;
+
+    return 0;
+}
+
+// builds source -> caps -> queue -> sink, the sensor gives YUV at the output size and the Y plane is used as the gray image
+static int gstream_build_native(StreamSet *ss, Settings *settings) {
+    ss->convert = NULL;
+    ss->scale = NULL;
+
+    // NV12 and I420 both start with a full resolution Y plane, the frame view only reads that plane
+    GstCaps *capsyuv = gst_caps_new_simple(
+        "video/x-raw",
+        "width", G_TYPE_INT, settings->width,
+        "height", G_TYPE_INT, settings->height,
+        "framerate", GST_TYPE_FRACTION, settings->framerate, 1,
+        NULL);
+    GstCaps *capsformats = gst_caps_from_string("video/x-raw,format=(string){NV12,I420}");
+    GstCaps *capssrc = gst_caps_intersect(capsyuv, capsformats);
+    gst_caps_unref(capsyuv);
+    gst_caps_unref(capsformats);
+
+    g_object_set(G_OBJECT(ss->caps), "caps", capssrc, NULL);
+    gst_app_sink_set_caps(GST_APP_SINK(ss->sink), capssrc);
+    gst_caps_unref(capssrc);
+
+    gst_bin_add_many(GST_BIN (ss->pipeline), ss->source, ss->caps, ss->queue, ss->sink, NULL);
+    if (!gst_element_link_many(ss->source, ss->caps, ss->queue, ss->sink, NULL)) {
+        g_printerr("Elements could not be linked.\n");
+        return 2;
+    }
+
+    ss->mode = CAPTURE_NATIVE;
+
+    return 0;
+}
+
+// frees the preprocessed frame pool, safe to call when it was never allocated
+static void gstream_free_pool(StreamSet *ss) {
+    for (int i = 0; i < PRE_BUFFERS; i++) {
+        free(ss->buffers[i]);
+        ss->buffers[i] = NULL;
+    }
+
+    preprocess_destroy(&ss->pre);
+}
+
+// builds source -> caps -> queue -> sink, the sensor gives BGRx at prescale times the output size
+// and gstream_pull_frame turns it into gray at the output size in a single pass
+static int gstream_build_fused(StreamSet *ss, Settings *settings) {
+    ss->convert = NULL;
+    ss->scale = NULL;
+
+    if (preprocess_init(&ss->pre, settings->prescale, settings->pre_blur, settings->width)) return 1;
+
+    // rows padded to 16 bytes like the replay buffers
+    ss->stride = (settings->width + 15) & ~15;
+    for (int i = 0; i < PRE_BUFFERS; i++) {
+        ss->buffers[i] = (uint8_t *)malloc((size_t)ss->stride * settings->height);
+        ss->busy[i] = 0;
+
+        if (ss->buffers[i] == NULL) {
+            perror("Preprocessed frame allocation failed");
+            return 1;
+        }
+    }
+
+    GstCaps *capssrc = gst_caps_new_simple(
+        "video/x-raw",
+        "format", G_TYPE_STRING, "BGRx",
+        "width", G_TYPE_INT, settings->width * settings->prescale,
+        "height", G_TYPE_INT, settings->height * settings->prescale,
+        "framerate", GST_TYPE_FRACTION, settings->framerate, 1,
+        NULL);
+
+    g_object_set(G_OBJECT(ss->caps), "caps", capssrc, NULL);
+    gst_app_sink_set_caps(GST_APP_SINK(ss->sink), capssrc);
+    gst_caps_unref(capssrc);
+
+    gst_bin_add_many(GST_BIN (ss->pipeline), ss->source, ss->caps, ss->queue, ss->sink, NULL);
+    if (!gst_element_link_many(ss->source, ss->caps, ss->queue, ss->sink, NULL)) {
+        g_printerr("Elements could not be linked.\n");
+        return 2;
+    }
+
+    printf("Preprocessing with the %s kernel, %dx downscale%s\n",
+        preprocess_kernel_name(ss->pre.kernel), settings->prescale, settings->pre_blur ? " and blur" : "");
+
+    ss->mode = CAPTURE_FUSED;
+
+    return 0;
+}
+
+// creates the pipeline and the elements shared by every capture mode
+static int gstream_create(StreamSet *ss, uint8_t emit_signals, uint8_t sync) {
+    ss->pipeline = gst_pipeline_new("pipeline");
+
+    ss->source = gst_element_factory_make("libcamerasrc", "source");
+    ss->caps = gst_element_factory_make("capsfilter", "caps");
+    ss->queue = gst_element_factory_make("queue", "queue");
+    ss->sink = gst_element_factory_make("appsink", "sink");
+
+    // check if things were created correctly
+    if (!ss->pipeline || !ss->queue || !ss->source || !ss->caps || !ss->sink) {
+        g_printerr("Not all elements could be created.\n");
+        return 1;
+    }
+
+    // set data to objects, customize filters, the appsink itself never holds more than the newest buffer
+    g_object_set(ss->sink,
+        "emit-signals", emit_signals, 
+        "sync", sync, 
+        "max-buffers", 1,
+        "drop", TRUE,
+        NULL);
+
+    return 0;
+}
+
+// converts a buffer PTS to monotonic time in us, the PTS is running time on the pipeline clock
+static gint64 gstream_capture_time(GstElement *element, GstBuffer *buffer, gint64 arrival) {
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    GstClock *clock = gst_element_get_clock(element);
+
+    // without a PTS or a clock the best estimate is the arrival time
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || clock == NULL) {
+        if (clock != NULL) gst_object_unref(clock);
+        return arrival;
+    }
+
+    // absolute clock time of the exposure, shifted by how far the pipeline clock is from the monotonic clock
+    GstClockTimeDiff offset = (GstClockTimeDiff)g_get_monotonic_time() * 1000 - (GstClockTimeDiff)gst_clock_get_time(clock);
+    GstClockTimeDiff exposure = (GstClockTimeDiff)(gst_element_get_base_time(element) + pts) + offset;
+    gst_object_unref(clock);
+
+    return exposure / 1000;
+}
+
+// runs on the streaming thread behind the queue for every new sample, replaces whatever the slot held
+static GstFlowReturn gstream_on_new_sample(GstAppSink *sink, gpointer user_data) {
+    CaptureSlot *slot = (CaptureSlot *)user_data;
+
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (sample == NULL) return GST_FLOW_OK;
+
+    gint64 now = g_get_monotonic_time();
+    gint64 capture = gstream_capture_time(GST_ELEMENT(sink), gst_sample_get_buffer(sample), now);
+
+    g_mutex_lock(&slot->lock);
+
+    GstSample *stale = slot->latest;
+    if (stale != NULL) slot->dropped++;
+
+    slot->latest = sample;
+    slot->capture = capture;
+    slot->arrival = now;
+    slot->received++;
+
+    g_cond_signal(&slot->ready);
+    g_mutex_unlock(&slot->lock);
+
+    // unref outside of the lock, this can free the buffer back to the camera
+    if (stale != NULL) gst_sample_unref(stale);
+
+    return GST_FLOW_OK;
+}
+
+// hands every new sample to the capture slot instead of letting the appsink queue them
+static void gstream_attach_slot(StreamSet *ss) {
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = gstream_on_new_sample;
+
+    gst_app_sink_set_callbacks(GST_APP_SINK(ss->sink), &callbacks, &ss->slot, NULL);
+}
+
+// waits for the first sample, returns nonzero when the pipeline failed to negotiate or errored out
+// mode names the pipeline in the error message
+static int gstream_wait_first_sample(StreamSet *ss, const char *mode) {
+    GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(ss->sink), NEGOTIATE_TIMEOUT);
+
+    if (sample == NULL) {
+        GstBus *bus = gst_element_get_bus(ss->pipeline);
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, 0, GST_MESSAGE_ERROR);
+
+        if (msg != NULL) {
+            GError *err;
+            gchar *debug_info;
+
+            gst_message_parse_error(msg, &err, &debug_info);
+            g_printerr("%s capture failed in element %s: %s\n", mode, GST_OBJECT_NAME(msg->src), err->message);
+            g_clear_error(&err);
+            g_free(debug_info);
+            gst_message_unref(msg);
+        }
+
+        gst_object_unref(bus);
+        return 1;
+    }
+
+    gst_sample_unref(sample);
+    return 0;
+}
+
+int gstream_setup(StreamSet *ss, Settings *settings, uint8_t emit_signals, uint8_t sync) {
+    int ec;
+
+    memset(&ss->slot, 0, sizeof(CaptureSlot));
+    g_mutex_init(&ss->slot.lock);
+    g_cond_init(&ss->slot.ready);
+
+    memset(&ss->pre, 0, sizeof(Preprocessor));
+    memset(ss->buffers, 0, sizeof(ss->buffers));
+
+    if (settings->capture_mode == CAPTURE_NATIVE || settings->capture_mode == CAPTURE_FUSED) {
+        ec = gstream_create(ss, emit_signals, sync);
+        if (ec) return ec;
+
+        if (settings->capture_mode == CAPTURE_NATIVE) ec = gstream_build_native(ss, settings);
+        else ec = gstream_build_fused(ss, settings);
+
+        if (!ec) {
+            gst_element_set_state(ss->pipeline, GST_STATE_PLAYING);
+            ec = gstream_wait_first_sample(ss, settings->capture_mode == CAPTURE_NATIVE ? "Native" : "Fused");
+        }
+
+        if (!ec) {
+            gstream_attach_slot(ss);
+            return 0;
+        }
+
+        // the sensor can't give this format at this size and rate, tear down and use the converting pipeline
+        g_printerr("Native or fused capture unavailable, falling back to converted capture.\n");
+        gst_element_set_state(ss->pipeline, GST_STATE_NULL);
+        gst_object_unref(ss->pipeline);
+        gstream_free_pool(ss);
+
+        // the pipeline is stopped, so the callback can't refill the slot anymore
+        // the lock and condition stay initialized, the converting pipeline's callback uses them next
+        if (ss->slot.latest != NULL) gst_sample_unref(ss->slot.latest);
+        ss->slot.latest = NULL;
+        ss->slot.received = 0;
+        ss->slot.taken = 0;
+        ss->slot.dropped = 0;
+    }
+
+    ec = gstream_create(ss, emit_signals, sync);
+    if (ec) return ec;
+
+    ec = gstream_build_convert(ss, settings);
+    if (ec) {
+        gst_object_unref(ss->pipeline);
+        return ec;
+    }
+
+    gstream_attach_slot(ss);
+
     // set the state to playing once everything is properly set up
     if (ss->pipeline->current_state != GST_STATE_PLAYING) gst_element_set_state(ss->pipeline, GST_STATE_PLAYING);
 
     return 0;
 }
 
-int gstream_pull_sample(StreamSet *ss, uint8_t *data, Settings *settings) {
-    // pull the sample
-    GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(ss->sink), GST_SECOND / settings->framerate);
-    
+// converts a mapped BGRx frame into a pool buffer and releases the sample, the frame then holds the buffer
+static int gstream_preprocess_frame(StreamSet *ss, Frame *frame, const uint8_t *data, gint stride, gint width, gint height) {
+    int b;
+    for (b = 0; b < PRE_BUFFERS; b++) {
+        if (__atomic_exchange_n(&ss->busy[b], 1, __ATOMIC_ACQUIRE) == 0) break;
+    }
+
+    if (b == PRE_BUFFERS) {
+        gstream_release_frame(frame);
+        return 5;
+    }
+
+    int w = width / ss->pre.factor;
+    int h = height / ss->pre.factor;
+    int ec = preprocess_run(&ss->pre, data, stride, w, h, ss->buffers[b], ss->stride);
+
+    // the gray copy is all that's needed, give the camera its buffer back now
+    gstream_release_frame(frame);
+
+    if (ec) {
+        __atomic_store_n(&ss->busy[b], 0, __ATOMIC_RELEASE);
+        return 6;
+    }
+
+    image_u8_t view = {
+        .width = w,
+        .height = h,
+        .stride = ss->stride,
+        .buf = ss->buffers[b]
+    };
+    memcpy(&frame->im, &view, sizeof(image_u8_t));
+    frame->hold = &ss->busy[b];
+
+    return 0;
+}
+
+int gstream_pull_frame(StreamSet *ss, Frame *frame, Settings *settings) {
+    CaptureSlot *slot = &ss->slot;
+    gint64 deadline = g_get_monotonic_time() + G_TIME_SPAN_SECOND / settings->framerate;
+    gint64 capture = 0, arrival = 0;
+
+    // take the newest sample, it stays referenced until the frame is released
+    g_mutex_lock(&slot->lock);
+    while (slot->latest == NULL) {
+        if (!g_cond_wait_until(&slot->ready, &slot->lock, deadline)) break;
+    }
+
+    frame->sample = slot->latest;
+    if (frame->sample != NULL) {
+        capture = slot->capture;
+        arrival = slot->arrival;
+        frame->seq = slot->received;
+        slot->latest = NULL;
+        slot->taken++;
+    }
+    g_mutex_unlock(&slot->lock);
+
     // don't continue if sample is not found
-    if (!sample) return 1;
+    if (!frame->sample) return 1;
 
-    // load a buffer and a map for sample
-    GstBuffer *buffer = gst_sample_get_buffer(sample);
-    GstMapInfo map;
+    frame->hold = NULL;
+    memset(&frame->times, 0, sizeof(StageTimes));
+    frame->times.capture = capture;
+    frame->times.arrival = arrival;
+    frame->age = g_get_monotonic_time() - capture;
 
-    // if the buffer can be read, copy the map data to an external array
-    if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
-        // printf("Frame: %d bytes\n", map.size);
-        memcpy(data, map.data, map.size);
+    // map the buffer in place instead of copying it out
+    frame->buffer = gst_sample_get_buffer(frame->sample);
+    if (!gst_buffer_map(frame->buffer, &frame->map, GST_MAP_READ)) {
+        gst_sample_unref(frame->sample);
+        frame->sample = NULL;
+        return 2;
+    }
 
-        gst_buffer_unmap(buffer, &map);
+    // get the layout of the first plane, the video meta has the real stride when rows are padded
+    gsize offset;
+    gint stride, width, height;
+    GstVideoMeta *meta = gst_buffer_get_video_meta(frame->buffer);
+
+    if (meta != NULL) {
+        offset = meta->offset[0];
+        stride = meta->stride[0];
+        width = meta->width;
+        height = meta->height;
     }
+    else {
+        GstVideoInfo vinfo;
+        if (!gst_video_info_from_caps(&vinfo, gst_sample_get_caps(frame->sample))) {
+            gstream_release_frame(frame);
+            return 3;
+        }
 
-    gst_sample_unref(sample);
+        offset = GST_VIDEO_INFO_PLANE_OFFSET(&vinfo, 0);
+        stride = GST_VIDEO_INFO_PLANE_STRIDE(&vinfo, 0);
+        width = GST_VIDEO_INFO_WIDTH(&vinfo);
+        height = GST_VIDEO_INFO_HEIGHT(&vinfo);
+    }
+
+    // make sure the view doesn't read past the end of the mapped memory
+    gsize bpp = ss->mode == CAPTURE_FUSED ? 4 : 1;
+    if (offset + (gsize)stride * (height - 1) + width * bpp > frame->map.size) {
+        gstream_release_frame(frame);
+        return 4;
+    }
+
+    if (ss->mode == CAPTURE_FUSED) return gstream_preprocess_frame(ss, frame, frame->map.data + offset, stride, width, height);
+
+    // image_u8_t has const dimensions, so the view is built and copied over the frame's copy
+    image_u8_t view = {
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .buf = frame->map.data + offset
+    };
+    memcpy(&frame->im, &view, sizeof(image_u8_t));
+
+    return 0;
+}
+
+int gstream_release_frame(Frame *frame) {
+    // frames from a buffer pool only have to give the buffer back
+    if (frame->hold != NULL) {
+        __atomic_store_n(frame->hold, 0, __ATOMIC_RELEASE);
+        frame->hold = NULL;
+        return 0;
+    }
+
+    // unmaps and unrefs the sample, frame->im is invalid afterwards
+    if (frame->sample == NULL) return 1;
+
+    gst_buffer_unmap(frame->buffer, &frame->map);
+    gst_sample_unref(frame->sample);
+
+    frame->sample = NULL;
+    frame->buffer = NULL;
 
     return 0;
 }
@@ -132,6 +488,16 @@ int gstream_pull_sample(StreamSet *ss, uint8_t *data, Settings *settings) {
 //     return 0;
 // }
 
+int gstream_get_stats(StreamSet *ss, CaptureStats *stats) {
+    g_mutex_lock(&ss->slot.lock);
+    stats->received = ss->slot.received;
+    stats->taken = ss->slot.taken;
+    stats->dropped = ss->slot.dropped;
+    g_mutex_unlock(&ss->slot.lock);
+
+    return 0;
+}
+
 int gstream_cleanup(GstBus *bus, StreamSet *ss) {
     // unrefs objects passed by reference
 
@@ -141,6 +507,14 @@ int gstream_cleanup(GstBus *bus, StreamSet *ss) {
     if (ss != NULL) {
         gst_element_set_state(ss->pipeline, GST_STATE_NULL);
         gst_object_unref(ss->pipeline);
+
+        // the pipeline is stopped, so the callback can't refill the slot anymore
+        if (ss->slot.latest != NULL) gst_sample_unref(ss->slot.latest);
+        ss->slot.latest = NULL;
+        g_mutex_clear(&ss->slot.lock);
+        g_cond_clear(&ss->slot.ready);
+
+        gstream_free_pool(ss);
     }
     return 0;
 }
@@ -1,15 +1,15 @@
 #include <logger.h>
 
-int name_logfile(char *buf) {
+int name_logfile(char *buf, const char *dir, const char *ext) {
     int i = 0;
     struct stat st;
     
-    if (stat(LOG_DIR, &st) == -1) {
-        mkdir(LOG_DIR, 0755);
+    if (stat(dir, &st) == -1) {
+        mkdir(dir, 0755);
     }
 
     while (1) {
-        snprintf(buf, 256, "%s%s%d%s", LOG_DIR, DEFAULT_LOG_NAME, i, LOG_EXTENSION);
+        snprintf(buf, 256, "%s%s%d%s", dir, DEFAULT_LOG_NAME, i, ext);
         if (stat(buf, &st) == -1) {
             break;
         }
@@ -19,6 +19,33 @@ int name_logfile(char *buf) {
     return 0;
 }
 
+static void logger_options(Logger *logger, uint8_t options) {
+    logger->options = options;
+    logger->do_logging = 0b00000001 & options;
+    logger->log_images = 0b00000010 & options;
+    logger->log_dtime =  0b00000100 & options;
+    logger->log_time =   0b00001000 & options;
+    logger->log_ids =    0b00010000 & options;
+    logger->log_poses =  0b00100000 & options;
+    logger->log_quats =  0b01000000 & options;
+    logger->log_stages = 0b10000000 & options;
+}
+
+// every group ends in its own comma, so any set of options gives the same columns in the header and the rows
+void log_csv_header(int fd, uint8_t options) {
+    if (options & LO_EN_DTIME) dprintf(fd, "dt (ms),");
+    if (options & LO_EN_TIME) dprintf(fd, "t (s),");
+    if (options & LO_EN_IDS) {
+        dprintf(fd, "IDs,");
+        dprintf(fd, "nIDs,");
+    }
+    if (options & LO_EN_POSES) dprintf(fd, "pX (m),pY (m),pZ (m),");
+    if (options & LO_EN_QUATS) dprintf(fd, "qX,qY,qZ,qW,");
+    if (options & LO_EN_STAGES) dprintf(fd, "capture (us),arrival (us),detect start (us),detect end (us),transform (us),transmit (us),pose time (us),predicted,");
+
+    dprintf(fd, "\n");
+}
+
 int init_logger(Logger *logger, const char *log_file_path, uint8_t options) {
 
     int log_fd = open(log_file_path, O_CREAT | O_WRONLY | O_APPEND, 0644);
@@ -29,76 +56,111 @@ int init_logger(Logger *logger, const char *log_file_path, uint8_t options) {
     }
 
     logger->log_fd = log_fd;
-    logger->do_logging = 0b00000001 & options;
-    logger->log_images = 0b00000010 & options;
-    logger->log_dtime =  0b00000100 & options;
-    logger->log_time =   0b00001000 & options;
-    logger->log_ids =    0b00010000 & options;
-    logger->log_poses =  0b00100000 & options;
-    logger->log_quats =  0b01000000 & options;
+    logger->binary = false;
+    logger_options(logger, options);
 
     // Write CSV header
-    if (logger->log_dtime) dprintf(logger->log_fd, "dt (ms),");
-    if (logger->log_time) dprintf(logger->log_fd, "t (s),");
-    if (logger->log_ids) {
-        dprintf(logger->log_fd, "IDs,");
-        dprintf(logger->log_fd, "nIDs,");
-    }
-    if (logger->log_poses) dprintf(logger->log_fd, "pX (m),pY (m),pZ (m),");
-    if (logger->log_quats) dprintf(logger->log_fd, "qW (m),qX (m),qY (m),qZ (m)");
-
-    dprintf(logger->log_fd, "\n");
+    log_csv_header(logger->log_fd, options);
 
     return 0;
 }
 
-int log_message(Logger *logger, matd_t *p, matd_t *q, int *ids, int num_ids, struct timeval *tstart, struct timeval *tstop) {
-    if (!logger->do_logging) {
-        printf("Logging not enabled.\n");
-        return 0;
+int init_binary_logger(Logger *logger, const char *log_file_path, uint8_t options, uint64_t capacity, int sync_ms) {
+    if (flight_log_open(&logger->flight, log_file_path, capacity, options, sync_ms) != 0) {
+        return -1;
     }
 
-    gettimeofday(tstop, NULL);
-    
-    if (logger->log_dtime) {
-        int ms_elapsed = (tstop->tv_sec - tstart->tv_sec) * 1000 + (tstop->tv_usec - tstart->tv_usec) / 1000;
+    logger->log_fd = -1;
+    logger->binary = true;
+    logger_options(logger, options);
+
+    return 0;
+}
 
-        dprintf(logger->log_fd, "%d,", ms_elapsed);
-        gettimeofday(tstart, NULL);
+void log_record_csv(int fd, uint8_t options, const LogRecord *rec) {
+    if (options & LO_EN_DTIME) {
+        dprintf(fd, "%d,", rec->dt_ms);
     }
 
-    if (logger->log_time) {
-        int s = tstop->tv_sec;
-        int us = tstop->tv_usec;
+    if (options & LO_EN_TIME) {
+        int s = rec->wall_us / 1000000;
+        int us = rec->wall_us % 1000000;
         
-        dprintf(logger->log_fd, "%.6f,", (double)s + (double)us / 1E6);
+        dprintf(fd, "%.6f,", (double)s + (double)us / 1E6);
     }
 
-    if (logger->log_ids) {
-        for (int i = 0; i < num_ids; i++) {
-            dprintf(logger->log_fd, "%d/", ids[i]);
+    if (options & LO_EN_IDS) {
+        for (int i = 0; i < rec->nids; i++) {
+            dprintf(fd, "%d/", rec->ids[i]);
         }
-        dprintf(logger->log_fd, ",%d,", num_ids);
+        dprintf(fd, ",%d,", rec->nids);
+    }
+
+    if (options & LO_EN_POSES) {
+        dprintf(fd, "%.6f,%.6f,%.6f,", rec->p[0], rec->p[1], rec->p[2]);
     }
 
-    if (logger->log_poses) {
-        dprintf(logger->log_fd, "%.6f,%.6f,%.6f,", matd_get(p, 0, 0), matd_get(p, 1, 0), matd_get(p, 2, 0));
+    if (options & LO_EN_QUATS) {
+        dprintf(fd, "%.6f,%.6f,%.6f,%.6f,", rec->q[0], rec->q[1], rec->q[2], rec->q[3]);
     }
 
-    if (logger->log_quats) {
-        dprintf(logger->log_fd, "%.6f,%.6f,%.6f,%.6f", matd_get(q, 0, 0), matd_get(q, 1, 0), matd_get(q, 2, 0), matd_get(q, 3, 0));
+    // monotonic stage times, differences between them give the latency of each stage and glass-to-wire
+    if (options & LO_EN_STAGES) {
+        dprintf(fd, "%lld,%lld,%lld,%lld,%lld,%lld,%lld,%d,",
+            (long long)rec->times.capture, (long long)rec->times.arrival, (long long)rec->times.detect_start,
+            (long long)rec->times.detect_end, (long long)rec->times.transform, (long long)rec->times.transmit,
+            (long long)rec->time, rec->predicted);
     }
 
-    dprintf(logger->log_fd, "\n");
+    dprintf(fd, "\n");
+}
+
+int log_message(Logger *logger, Vec3 *p, Quat *q, int64_t time, uint8_t predicted, int status, int *ids, int num_ids, StageTimes *times, struct timeval *tstart, struct timeval *tstop) {
+    if (!logger->do_logging) {
+        printf("Logging not enabled.\n");
+        return 0;
+    }
+
+    gettimeofday(tstop, NULL);
+
+    // filled on the stack either way, the binary log only copies it into the mapping
+    LogRecord rec;
+    rec.index = 0;
+    rec.wall_us = (int64_t)tstop->tv_sec * 1000000 + tstop->tv_usec;
+    rec.dt_ms = (tstop->tv_sec - tstart->tv_sec) * 1000 + (tstop->tv_usec - tstart->tv_usec) / 1000;
+    *tstart = *tstop;
+
+    if (num_ids > FLIGHT_LOG_MAX_IDS) num_ids = FLIGHT_LOG_MAX_IDS;
+    rec.nids = num_ids;
+    rec.predicted = predicted;
+    rec.status = status < -128 ? -128 : status > 127 ? 127 : status;
+    rec.reserved = 0;
+    rec.times = *times;
+    rec.time = time;
+    memcpy(rec.p, p->v, sizeof(rec.p));
+    rec.q[0] = q->x;
+    rec.q[1] = q->y;
+    rec.q[2] = q->z;
+    rec.q[3] = q->w;
+    for (int i = 0; i < num_ids; i++) rec.ids[i] = ids[i];
+
+    if (logger->binary) {
+        flight_log_write(&logger->flight, &rec);
+    }
+    else {
+        log_record_csv(logger->log_fd, logger->options, &rec);
+    }
 
     return 0;
 }
 
 int close_logger(Logger *logger) {
+    if (logger->binary) return flight_log_close(&logger->flight);
+
     if (close(logger->log_fd) == -1) {
         perror("Failed to close log file");
         return -1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,10 +1,14 @@
 #include <settings.h>
 #include <gstream_from_cam.h>
+#include <replay.h>
 #include <detect_apriltags.h>
 #include <transmit_pose.h>
 #include <logger.h>
+#include <stages.h>
 
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 volatile sig_atomic_t stop;
 
@@ -12,7 +16,73 @@ void handle_sigint(int sig) {
     stop = 1;
 }
 
+// one startup step that doesn't depend on the others, run on its own thread
+typedef struct _InitTask {
+    pthread_t thread;
+    Settings *settings;
+    StreamSet *streams;
+    ReplaySet *replay;
+    DetectWorker *worker;
+    UARTInfo *uart_info;
+    TagMap *map;
+
+    int ec;
+    int64_t took; // us
+} InitTask;
+
+// camera or replay, the camera waits for its first frame so this is usually the slowest step
+static void *init_source(void *arg) {
+    InitTask *task = (InitTask *)arg;
+    int64_t start = monotonic_us();
+
+    if (task->settings->source_mode == SOURCE_CAMERA) {
+        // samples are delivered through the capture slot callback
+        task->ec = gstream_setup(task->streams, task->settings, FALSE, FALSE);
+    }
+    else {
+        // no camera needed, frames are played back from disk
+        task->ec = replay_open(task->replay, task->settings);
+    }
+
+    task->took = monotonic_us() - start;
+    return NULL;
+}
+
+static void *init_detector(void *arg) {
+    InitTask *task = (InitTask *)arg;
+    int64_t start = monotonic_us();
+    DetectWorker *w = task->worker;
+
+    task->ec = apriltag_setup(&w->td, &w->tf, &w->info, &w->cache, task->settings);
+
+    task->took = monotonic_us() - start;
+    return NULL;
+}
+
+static void *init_uart(void *arg) {
+    InitTask *task = (InitTask *)arg;
+    int64_t start = monotonic_us();
+
+    task->ec = init_transmit_pose(task->uart_info, task->settings);
+
+    task->took = monotonic_us() - start;
+    return NULL;
+}
+
+// a large map file takes a moment to parse, so it loads alongside the rest
+static void *init_map(void *arg) {
+    InitTask *task = (InitTask *)arg;
+    int64_t start = monotonic_us();
+
+    task->ec = tag_map_init(task->map, task->settings);
+
+    task->took = monotonic_us() - start;
+    return NULL;
+}
+
 int main(int argc, char *argv[]) {
+    int64_t started = monotonic_us();
+
     setenv("GST_DEBUG", "3", 1);
     gst_init(&argc, &argv);
 
@@ -26,40 +96,27 @@ int main(int argc, char *argv[]) {
     GstBus *bus;
     GstState *state1, *state2;
 
-    uint8_t *data; // image data
-
-    // apriltag items
-    apriltag_detector_t *td;
-    apriltag_family_t *tf;
-    apriltag_detection_info_t info;
-    apriltag_pose_t poses[MAX_DETECTIONS]; // array to hold all detected positions
-    int ids[MAX_DETECTIONS]; // array to hold detected ids
-    uint8_t nids = 0;
-
-    // pose array and transmission
-    CoordDefs cd;
-    matd_t *p = matd_create(3, 1); // position vector
-    matd_t *q = matd_create(4, 1); // quaternion vector
+    // recorded frames used instead of the camera, and the optional recording of processed frames
+    ReplaySet replay;
+    Recorder recorder = { 0 };
 
+    // pose transformation and transmission
+    TagMap map;
     UARTInfo uart_info;
+    UARTTx uart_tx;
+    UARTLink uart_link;
+    TransportSet outputs;
+    int use_uart; // the UART carries poses, clock sync or both
+
+    // capture, detection, transformation, transmission and logging each run on their own thread
+    Stages stages;
 
     // logging setup
     Logger logger;
-    uint8_t log_options = LO_EN | LO_EN_IDS | LO_EN_POSES | LO_EN_QUATS | LO_EN_DTIME | LO_EN_TIME;
-    struct timeval tstart, tstop;
+    uint8_t log_options = LO_EN | LO_EN_IDS | LO_EN_POSES | LO_EN_QUATS | LO_EN_DTIME | LO_EN_TIME | LO_EN_STAGES;
 
-    char *log_filename = (char *)malloc(256 * sizeof(char));
-    if (log_filename == NULL) {
-        perror("Log filename allocation failed\n");
-        exit(1);
-    }
-    name_logfile(log_filename);
-
-    ec = init_logger(&logger, log_filename, log_options);
-    if (ec) {
-        printf("Logger initialization failed with error code: %d\n", ec);
-        exit(2);
-    }
+    // with --check-allocs after the settings the exit status says whether the later stages allocated per frame
+    int check_allocs = argc > 2 && strcmp(argv[2], "--check-allocs") == 0;
 
     // read in settings from json file, #TODO: make the path an arg (using stropts?)
     ec = load_settings_from_path(argv[1], &settings);
@@ -69,91 +126,172 @@ int main(int argc, char *argv[]) {
     }
     settings.np = settings.width * settings.height;
 
-    // perform setup, check error output
-    ec = gstream_setup(&streams, &settings, TRUE, FALSE);
+    char *log_filename = (char *)malloc(256 * sizeof(char));
+    if (log_filename == NULL) {
+        perror("Log filename allocation failed\n");
+        exit(1);
+    }
+    name_logfile(log_filename, settings.output_directory, settings.log_binary ? FLIGHT_LOG_EXTENSION : LOG_EXTENSION);
+
+    if (settings.log_binary) ec = init_binary_logger(&logger, log_filename, log_options, settings.log_records, settings.log_sync_ms);
+    else ec = init_logger(&logger, log_filename, log_options);
     if (ec) {
-        g_printerr("Gstream setup returned error code: %d\n", ec);
-        exit(4);
+        printf("Logger initialization failed with error code: %d\n", ec);
+        exit(2);
     }
 
-    bus = gst_element_get_bus(streams.pipeline);
+    // the frame source, every detector instance and the UART don't depend on each other, so they start together
+    stages.nworkers = settings.detectors;
+    if (stages.nworkers < 1) stages.nworkers = 1;
+    if (stages.nworkers > MAX_DETECTORS) stages.nworkers = MAX_DETECTORS;
 
-    // allocating data 
-    data = (uint8_t *)malloc(settings.np * settings.stride);
-    if (data == NULL) {
-        perror("Image data allocation failed\n");
-        exit(5);
+    InitTask base = { .settings = &settings, .streams = &streams, .replay = &replay, .uart_info = &uart_info, .map = &map };
+    InitTask source_task = base, uart_task = base, map_task = base;
+    InitTask detector_tasks[MAX_DETECTORS];
+
+    pthread_create(&source_task.thread, NULL, init_source, &source_task);
+    use_uart = settings.output_uart || settings.clock_sync;
+    if (use_uart) pthread_create(&uart_task.thread, NULL, init_uart, &uart_task);
+    pthread_create(&map_task.thread, NULL, init_map, &map_task);
+    for (int i = 0; i < stages.nworkers; i++) {
+        detector_tasks[i] = base;
+        detector_tasks[i].worker = &stages.workers[i];
+        pthread_create(&detector_tasks[i].thread, NULL, init_detector, &detector_tasks[i]);
     }
 
-    // perform apriltag setup
-    ec = apriltag_setup(&td, &tf, &info, &settings);
-    if (ec) {
-        printf("Setup returned error code: %d\n", ec);
+    pthread_join(source_task.thread, NULL);
+    if (use_uart) pthread_join(uart_task.thread, NULL);
+    pthread_join(map_task.thread, NULL);
+    int64_t detectors_took = 0;
+    for (int i = 0; i < stages.nworkers; i++) {
+        pthread_join(detector_tasks[i].thread, NULL);
+        if (detector_tasks[i].took > detectors_took) detectors_took = detector_tasks[i].took;
     }
 
-    // perform UART setup
-    ec = init_transmit_pose(&uart_info, &settings, &cd);
+    printf("Startup: source %.1f ms, detectors %.1f ms, UART %.1f ms, tag map %.1f ms, ready after %.1f ms\n",
+        source_task.took / 1000.0, detectors_took / 1000.0, uart_task.took / 1000.0, map_task.took / 1000.0,
+        (monotonic_us() - started) / 1000.0);
+
+    // perform setup, check error output
+    ec = source_task.ec;
     if (ec) {
-        printf("UART initialization failed with error code: %d\n", ec);
-        exit(6);
+        printf("%s setup returned error code: %d\n", settings.source_mode == SOURCE_CAMERA ? "Gstream" : "Replay", ec);
+        exit(4);
     }
+    if (settings.source_mode == SOURCE_CAMERA) bus = gst_element_get_bus(streams.pipeline);
 
-    // #TODO: create a proper g_loop and create a bus watch
-    while(!stop) {
-
-        gettimeofday(&tstart, NULL);
-        // pulling sample from camera and print bus error message, the only gstream functions used in a loop
-        ec = gstream_pull_sample(&streams, data, &settings);
+    if (settings.record_path[0] != '\0') {
+        ec = recorder_open(&recorder, settings.record_path, settings.width, settings.height);
         if (ec) {
-            continue;
-            // do not exit, run something to fix the break in timing
+            printf("Recorder initialization failed with error code: %d\n", ec);
+            exit(5);
         }
+    }
 
-        // detect apriltags and update the pose and ids array
-        ec = apriltag_detect(td, data, &info, poses, &settings, ids, &nids);
+    // apriltag setup, one independent detector per instance
+    for (int i = 0; i < stages.nworkers; i++) {
+        ec = detector_tasks[i].ec;
         if (ec) {
-            printf("Apriltag detection returned error code: %d\n", ec);
-            // do not exit, perform error handling based on what happened
-            if (ec == 3) {
-                // no detections, continue
-                continue;
-            }
+            printf("Setup returned error code: %d\n", ec);
         }
+    }
 
-        ec = pose_transform(p, q, poses, &cd, ids, nids);
+    // UART setup
+    if (use_uart) {
+        ec = uart_task.ec;
         if (ec) {
-            printf("Pose transformation returned error code: %d\n", ec);
+            printf("UART initialization failed with error code: %d\n", ec);
+            exit(6);
         }
 
-        ec = transmit_pose(&uart_info, p, q);
+        ec = uart_tx_start(&uart_tx, &uart_info, settings.uart_report_ms);
         if (ec) {
-            printf("Pose transmission returned error code: %d\n", ec);
+            printf("UART writer failed to start with error code: %d\n", ec);
+            exit(6);
         }
+    }
 
-        ec = log_message(&logger, p, q, ids, nids, &tstart, &tstop);
+    ec = transports_open(&outputs, &settings, &uart_tx);
+    if (ec) {
+        printf("Pose outputs failed to open with error code: %d\n", ec);
+        exit(9);
+    }
+
+    if (settings.clock_sync) {
+        ec = uart_link_start(&uart_link, &uart_info, &uart_tx, settings.sync_interval_ms);
         if (ec) {
-            printf("Logging returned error code: %d\n", ec);
+            printf("UART reader failed to start with error code: %d\n", ec);
+            exit(6);
         }
     }
 
-    printf("Exiting main loop...\n");
+    ec = map_task.ec;
+    if (ec) {
+        printf("Tag map failed to load with error code: %d\n", ec);
+        exit(8);
+    }
+
+    stages.settings = &settings;
+    stages.streams = &streams;
+    stages.replay = &replay;
+    stages.recorder = &recorder;
+    stages.map = &map;
+    stages.outputs = &outputs;
+    stages.uart_link = settings.clock_sync ? &uart_link : NULL;
+    stages.logger = &logger;
+    stages.started = started;
 
-    // gstreamer cleanup
-    ec = gstream_cleanup(bus, &streams);
+    ec = stages_start(&stages);
     if (ec) {
-        g_printerr("Cleanup returned error code: %d\n", ec);
-        exit(6);
+        printf("Starting the tracking stages failed with error code: %d\n", ec);
+        exit(7);
     }
-    // apriltag cleanup
-    apriltag_cleanup(&td, &tf, &info);
 
-    matd_destroy(p);
-    matd_destroy(q);
-    
-    // free dynamically allocated image data array
-    free(data);
+    // #TODO: create a proper g_loop and create a bus watch
+    while(!stop && !stages_finished(&stages)) {
+        usleep(STAGE_POLL_US);
+    }
+
+    stages_stop(&stages);
+    int allocated = check_allocs && stages_steady_allocs(&stages);
+    if (settings.clock_sync) uart_link_stop(&uart_link);
+    transports_close(&outputs);
+    if (use_uart) uart_tx_stop(&uart_tx);
+
+    printf("Exiting main loop...\n");
 
+    CaptureStats stats;
+    if (settings.source_mode == SOURCE_CAMERA) gstream_get_stats(&streams, &stats);
+    else replay_get_stats(&replay, &stats);
+    printf("Frames received: %llu, processed: %llu, dropped as stale: %llu\n",
+        (unsigned long long)stats.received, (unsigned long long)stats.taken, (unsigned long long)stats.dropped);
+
+    // gstreamer or replay cleanup
+    if (settings.source_mode == SOURCE_CAMERA) {
+        ec = gstream_cleanup(bus, &streams);
+        if (ec) {
+            g_printerr("Cleanup returned error code: %d\n", ec);
+            exit(6);
+        }
+    }
+    else {
+        replay_close(&replay);
+    }
+
+    recorder_close(&recorder);
+    // apriltag cleanup
+    for (int i = 0; i < stages.nworkers; i++) {
+        DetectWorker *w = &stages.workers[i];
+        apriltag_cleanup(&w->td, &w->tf, &w->info, &w->cache);
+    }
+
+    tag_map_free(&map);
     close_logger(&logger);
 
+    if (allocated) {
+        printf("Steady state allocation check failed\n");
+        exit(11);
+    }
+
     exit(0);
 }
\ No newline at end of file
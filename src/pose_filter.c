@@ -0,0 +1,135 @@
+#include <pose_filter.h>
+
+int pose_filter_init(PoseFilter *pf, Settings *settings) {
+    memset(pf, 0, sizeof(PoseFilter));
+
+    pf->accel_noise = settings->kf_accel_noise * settings->kf_accel_noise;
+    pf->pos_noise = settings->kf_pos_noise * settings->kf_pos_noise;
+    pf->ang_accel_noise = settings->kf_ang_accel_noise * settings->kf_ang_accel_noise;
+    pf->att_noise = settings->kf_att_noise * settings->kf_att_noise;
+    pf->max_gap = settings->kf_max_predict;
+
+    return 0;
+}
+
+static void axis_reset(AxisFilter *a, double x, double r, double v_std) {
+    a->x = x;
+    a->v = 0;
+    a->P[0] = r;
+    a->P[1] = 0;
+    a->P[2] = v_std * v_std;
+}
+
+// x += v dt with white acceleration of density q over dt
+static void axis_predict(AxisFilter *a, double dt, double q) {
+    a->x += a->v * dt;
+
+    a->P[0] += dt * (2 * a->P[1] + dt * a->P[2]) + q * dt * dt * dt / 3;
+    a->P[1] += dt * a->P[2] + q * dt * dt / 2;
+    a->P[2] += q * dt;
+}
+
+// measurement z of x with variance r
+static void axis_update(AxisFilter *a, double z, double r) {
+    double y = z - a->x;
+    double S = a->P[0] + r;
+    double K0 = a->P[0] / S;
+    double K1 = a->P[1] / S;
+
+    a->x += K0 * y;
+    a->v += K1 * y;
+
+    a->P[2] -= K1 * a->P[1];
+    a->P[1] *= 1 - K0;
+    a->P[0] *= 1 - K0;
+}
+
+static void pose_filter_reset(PoseFilter *pf, Vec3 *p, Quat *q, int64_t time) {
+    for (int i = 0; i < 3; i++) {
+        axis_reset(&pf->pos[i], p->v[i], pf->pos_noise, KF_INIT_VEL_STD);
+        axis_reset(&pf->att[i], 0, pf->att_noise, KF_INIT_RATE_STD);
+    }
+
+    pf->q = *q;
+    pf->time = time;
+    pf->valid = 1;
+    pf->resets++;
+}
+
+// rotation of the attitude over dt at the filtered body rates
+static Quat att_step(PoseFilter *pf, double dt) {
+    Vec3 w = { { pf->att[0].v * dt, pf->att[1].v * dt, pf->att[2].v * dt } };
+    return quat_exp(&w);
+}
+
+int pose_filter_update(PoseFilter *pf, Vec3 *p, Quat *q, int64_t time) {
+    pf->updates++;
+
+    // measurements arrive in capture order, an older one can only come after a restart of the source
+    if (!pf->valid || time <= pf->time || time - pf->time > pf->max_gap) {
+        pose_filter_reset(pf, p, q, time);
+        return 0;
+    }
+
+    double dt = (time - pf->time) / 1e6;
+
+    for (int i = 0; i < 3; i++) {
+        axis_predict(&pf->pos[i], dt, pf->accel_noise);
+        axis_predict(&pf->att[i], dt, pf->ang_accel_noise);
+    }
+    Quat step = att_step(pf, dt);
+    pf->q = quat_mul(&pf->q, &step);
+
+    // the attitude error is the body rotation from the predicted to the measured attitude
+    Quat inv = quat_conj(&pf->q);
+    Quat dq = quat_mul(&inv, q);
+    Vec3 err = quat_log(&dq);
+
+    for (int i = 0; i < 3; i++) {
+        axis_update(&pf->pos[i], p->v[i], pf->pos_noise);
+
+        // the predicted angle already went into q, only the correction is left in x
+        pf->att[i].x = 0;
+        axis_update(&pf->att[i], err.v[i], pf->att_noise);
+    }
+
+    Vec3 corr = { { pf->att[0].x, pf->att[1].x, pf->att[2].x } };
+    Quat dc = quat_exp(&corr);
+    Quat qn = quat_mul(&pf->q, &dc);
+    pf->q = quat_normalize(&qn);
+    for (int i = 0; i < 3; i++) pf->att[i].x = 0;
+
+    pf->time = time;
+
+    for (int i = 0; i < 3; i++) p->v[i] = pf->pos[i].x;
+    *q = pf->q;
+
+    return 0;
+}
+
+int pose_filter_predict(PoseFilter *pf, int64_t time, Vec3 *p, Quat *q) {
+    if (!pf->valid || time - pf->time > pf->max_gap) return 1;
+
+    double dt = (time - pf->time) / 1e6;
+
+    for (int i = 0; i < 3; i++) p->v[i] = pf->pos[i].x + pf->pos[i].v * dt;
+
+    Quat step = att_step(pf, dt);
+    *q = quat_mul(&pf->q, &step);
+
+    return 0;
+}
+
+// P00 of axis_predict without touching the state
+static double axis_variance(const AxisFilter *a, double dt, double q) {
+    return a->P[0] + dt * (2 * a->P[1] + dt * a->P[2]) + q * dt * dt * dt / 3;
+}
+
+void pose_filter_sigma(PoseFilter *pf, int64_t time, float pos_sigma[3], float att_sigma[3]) {
+    double dt = time > pf->time ? (time - pf->time) / 1e6 : 0;
+
+    for (int i = 0; i < 3; i++) {
+        pos_sigma[i] = (float)sqrt(axis_variance(&pf->pos[i], dt, pf->accel_noise));
+        att_sigma[i] = (float)sqrt(axis_variance(&pf->att[i], dt, pf->ang_accel_noise));
+    }
+}
@@ -0,0 +1,380 @@
+#include <pose_packet.h>
+
+uint16_t packet_crc16(const uint8_t *data, size_t n) {
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < n; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+// little endian whatever the host is
+static uint8_t *put_le(uint8_t *p, uint64_t v, int n) {
+    for (int i = 0; i < n; i++) p[i] = (uint8_t)(v >> (8 * i));
+    return p + n;
+}
+
+static const uint8_t *get_le(const uint8_t *p, uint64_t *v, int n) {
+    *v = 0;
+    for (int i = 0; i < n; i++) *v |= (uint64_t)p[i] << (8 * i);
+    return p + n;
+}
+
+static uint8_t *put_f32(uint8_t *p, float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return put_le(p, u, 4);
+}
+
+static const uint8_t *get_f32(const uint8_t *p, float *f) {
+    uint64_t v;
+    p = get_le(p, &v, 4);
+    uint32_t u = (uint32_t)v;
+    memcpy(f, &u, sizeof(u));
+    return p;
+}
+
+size_t packet_encode(uint8_t type, const uint8_t *payload, uint8_t len, uint8_t *buf) {
+    uint8_t *p = buf;
+
+    *p++ = POSE_SYNC0;
+    *p++ = POSE_SYNC1;
+    *p++ = POSE_PACKET_VERSION;
+    *p++ = type;
+    *p++ = len;
+
+    memcpy(p, payload, len);
+    p += len;
+
+    // the sync bytes are left out, they carry nothing
+    p = put_le(p, packet_crc16(buf + 2, p - buf - 2), 2);
+
+    return p - buf;
+}
+
+size_t pose_packet_encode(const PosePacket *pkt, uint8_t *buf) {
+    uint8_t payload[POSE_PAYLOAD_SIZE];
+    uint8_t *p = payload;
+
+    p = put_le(p, pkt->seq, 2);
+    p = put_le(p, pkt->time, 8);
+    for (int i = 0; i < 3; i++) p = put_f32(p, pkt->position[i]);
+    for (int i = 0; i < 4; i++) p = put_f32(p, pkt->quat[i]);
+    *p++ = pkt->ntags;
+    *p++ = pkt->flags;
+
+    return packet_encode(PACKET_POSE, payload, POSE_PAYLOAD_SIZE, buf);
+}
+
+size_t ping_packet_encode(const PingPacket *pkt, uint8_t *buf) {
+    uint8_t payload[PING_PAYLOAD_SIZE];
+    uint8_t *p = payload;
+
+    p = put_le(p, pkt->seq, 2);
+    p = put_le(p, pkt->t1, 8);
+
+    return packet_encode(PACKET_PING, payload, PING_PAYLOAD_SIZE, buf);
+}
+
+size_t pong_packet_encode(const PongPacket *pkt, uint8_t *buf) {
+    uint8_t payload[PONG_PAYLOAD_SIZE];
+    uint8_t *p = payload;
+
+    p = put_le(p, pkt->seq, 2);
+    p = put_le(p, pkt->t1, 8);
+    p = put_le(p, pkt->t2, 8);
+    p = put_le(p, pkt->t3, 8);
+
+    return packet_encode(PACKET_PONG, payload, PONG_PAYLOAD_SIZE, buf);
+}
+
+size_t attitude_packet_encode(const AttitudePacket *pkt, uint8_t *buf) {
+    uint8_t payload[ATTITUDE_PAYLOAD_SIZE];
+    uint8_t *p = payload;
+
+    p = put_le(p, pkt->time, 8);
+    for (int i = 0; i < 4; i++) p = put_f32(p, pkt->quat[i]);
+
+    return packet_encode(PACKET_ATTITUDE, payload, ATTITUDE_PAYLOAD_SIZE, buf);
+}
+
+int pose_payload_parse(const uint8_t *payload, size_t len, PosePacket *pkt) {
+    const uint8_t *p = payload;
+    uint64_t v;
+
+    if (len != POSE_PAYLOAD_SIZE) return 1;
+
+    p = get_le(p, &v, 2);
+    pkt->seq = (uint16_t)v;
+    p = get_le(p, &v, 8);
+    pkt->time = v;
+    for (int i = 0; i < 3; i++) p = get_f32(p, &pkt->position[i]);
+    for (int i = 0; i < 4; i++) p = get_f32(p, &pkt->quat[i]);
+    pkt->ntags = *p++;
+    pkt->flags = *p++;
+
+    // the float encoding has no room for them
+    memset(pkt->pos_sigma, 0, sizeof(pkt->pos_sigma));
+    memset(pkt->att_sigma, 0, sizeof(pkt->att_sigma));
+
+    return 0;
+}
+
+int ping_payload_parse(const uint8_t *payload, size_t len, PingPacket *pkt) {
+    const uint8_t *p = payload;
+    uint64_t v;
+
+    if (len != PING_PAYLOAD_SIZE) return 1;
+
+    p = get_le(p, &v, 2);
+    pkt->seq = (uint16_t)v;
+    p = get_le(p, &v, 8);
+    pkt->t1 = v;
+
+    return 0;
+}
+
+int pong_payload_parse(const uint8_t *payload, size_t len, PongPacket *pkt) {
+    const uint8_t *p = payload;
+    uint64_t v;
+
+    if (len != PONG_PAYLOAD_SIZE) return 1;
+
+    p = get_le(p, &v, 2);
+    pkt->seq = (uint16_t)v;
+    p = get_le(p, &v, 8);
+    pkt->t1 = v;
+    p = get_le(p, &v, 8);
+    pkt->t2 = v;
+    p = get_le(p, &v, 8);
+    pkt->t3 = v;
+
+    return 0;
+}
+
+int attitude_payload_parse(const uint8_t *payload, size_t len, AttitudePacket *pkt) {
+    const uint8_t *p = payload;
+    uint64_t v;
+
+    if (len != ATTITUDE_PAYLOAD_SIZE) return 1;
+
+    p = get_le(p, &v, 8);
+    pkt->time = v;
+    for (int i = 0; i < 4; i++) p = get_f32(p, &pkt->quat[i]);
+
+    return 0;
+}
+
+// fixed point with rounding, saturating at the ends of an n bit signed range
+static int32_t to_fixed(double v, double scale, int bits) {
+    double max = (double)((1 << (bits - 1)) - 1);
+    double f = round(v * scale);
+    if (f > max) f = max;
+    if (f < -max - 1) f = -max - 1;
+    return (int32_t)f;
+}
+
+static uint8_t sigma_code(float sigma) {
+    if (!(sigma > 0)) return 0;
+
+    double code = 1 + round(12 * log2(sigma / 1e-5));
+    if (code < 1) return 1;
+    if (code > 255) return 255;
+    return (uint8_t)code;
+}
+
+static float sigma_value(uint8_t code) {
+    return code == 0 ? 0 : (float)(1e-5 * exp2((code - 1) / 12.0));
+}
+
+// smallest three, q and -q are the same rotation so the largest component can always be made positive
+static uint32_t quat_pack(const float q[4]) {
+    int largest = 0;
+    for (int i = 1; i < 4; i++) {
+        if (fabsf(q[i]) > fabsf(q[largest])) largest = i;
+    }
+
+    double n = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    double sign = q[largest] < 0 ? -1 : 1;
+    uint32_t packed = (uint32_t)largest << 30;
+    int shift = 20;
+
+    for (int i = 0; i < 4; i++) {
+        if (i == largest) continue;
+
+        // the others can't be larger than 1/sqrt(2) once the largest is taken out
+        double c = sign * q[i] / n * M_SQRT2;
+        long v = lround((c + 1) * 0.5 * 1023);
+        if (v < 0) v = 0;
+        if (v > 1023) v = 1023;
+
+        packed |= (uint32_t)v << shift;
+        shift -= 10;
+    }
+
+    return packed;
+}
+
+static void quat_unpack(uint32_t packed, float q[4]) {
+    int largest = packed >> 30;
+    double sum = 0;
+    int shift = 20;
+
+    for (int i = 0; i < 4; i++) {
+        if (i == largest) continue;
+
+        double c = ((packed >> shift) & 0x3FF) / 1023.0 * 2 - 1;
+        q[i] = (float)(c * M_SQRT1_2);
+        sum += q[i] * q[i];
+        shift -= 10;
+    }
+
+    q[largest] = (float)sqrt(sum < 1 ? 1 - sum : 0);
+}
+
+size_t compact_pose_encode(const PosePacket *pkt, uint8_t *buf) {
+    uint8_t payload[COMPACT_PAYLOAD_SIZE];
+    uint8_t *p = payload;
+
+    p = put_le(p, pkt->seq, 2);
+    p = put_le(p, pkt->time, 6);
+    for (int i = 0; i < 3; i++) p = put_le(p, (uint32_t)to_fixed(pkt->position[i], 1000, 24), 3);
+    p = put_le(p, quat_pack(pkt->quat), 4);
+    *p++ = pkt->ntags;
+    *p++ = pkt->flags;
+    for (int i = 0; i < 3; i++) *p++ = sigma_code(pkt->pos_sigma[i]);
+    for (int i = 0; i < 3; i++) *p++ = sigma_code(pkt->att_sigma[i]);
+
+    return packet_encode(PACKET_POSE_COMPACT, payload, COMPACT_PAYLOAD_SIZE, buf);
+}
+
+int compact_payload_parse(const uint8_t *payload, size_t len, PosePacket *pkt) {
+    const uint8_t *p = payload;
+    uint64_t v;
+
+    if (len != COMPACT_PAYLOAD_SIZE) return 1;
+
+    p = get_le(p, &v, 2);
+    pkt->seq = (uint16_t)v;
+    p = get_le(p, &v, 6);
+    pkt->time = v;
+    for (int i = 0; i < 3; i++) {
+        p = get_le(p, &v, 3);
+        // sign extend from 24 bits
+        int32_t mm = (int32_t)(v << 8) >> 8;
+        pkt->position[i] = mm / 1000.0f;
+    }
+    p = get_le(p, &v, 4);
+    quat_unpack((uint32_t)v, pkt->quat);
+    pkt->ntags = *p++;
+    pkt->flags = *p++;
+    for (int i = 0; i < 3; i++) pkt->pos_sigma[i] = sigma_value(*p++);
+    for (int i = 0; i < 3; i++) pkt->att_sigma[i] = sigma_value(*p++);
+
+    return 0;
+}
+
+// checks the framing and CRC of one complete packet, returns its size or a negative code
+static int packet_check(const uint8_t *buf, size_t n) {
+    if (n < POSE_HEADER_SIZE + 2 || buf[0] != POSE_SYNC0 || buf[1] != POSE_SYNC1) return -1;
+
+    size_t size = POSE_HEADER_SIZE + buf[4] + 2;
+    if (n < size) return -1;
+
+    uint64_t crc;
+    get_le(buf + size - 2, &crc, 2);
+    if (packet_crc16(buf + 2, size - 4) != crc) return -2;
+
+    if (buf[2] != POSE_PACKET_VERSION) return -3;
+
+    return (int)size;
+}
+
+int pose_packet_decode(const uint8_t *buf, size_t n, PosePacket *pkt) {
+    int size = packet_check(buf, n);
+    if (size < 0) return -size;
+
+    if (buf[3] == PACKET_POSE && pose_payload_parse(buf + POSE_HEADER_SIZE, buf[4], pkt) == 0) return 0;
+    if (buf[3] == PACKET_POSE_COMPACT && compact_payload_parse(buf + POSE_HEADER_SIZE, buf[4], pkt) == 0) return 0;
+
+    return 3;
+}
+
+void packet_parser_init(PacketParser *pp) {
+    memset(pp, 0, sizeof(PacketParser));
+}
+
+// drops the first byte of the candidate and looks for the next sync in what is left
+static void parser_resync(PacketParser *pp) {
+    size_t i = 1;
+    while (i < pp->len && pp->buf[i] != POSE_SYNC0) i++;
+
+    pp->skipped += i;
+    memmove(pp->buf, pp->buf + i, pp->len - i);
+    pp->len -= i;
+
+    // a lone leftover that isn't a sync pair goes too
+    if (pp->len >= 2 && pp->buf[1] != POSE_SYNC1) parser_resync(pp);
+}
+
+int packet_parser_feed(PacketParser *pp, uint8_t byte) {
+    if (pp->len == 0 && byte != POSE_SYNC0) {
+        pp->skipped++;
+        return 0;
+    }
+
+    pp->buf[pp->len++] = byte;
+
+    while (pp->len > 0) {
+        if (pp->len >= 2 && pp->buf[1] != POSE_SYNC1) {
+            parser_resync(pp);
+            continue;
+        }
+
+        // not enough for the length yet, or for the packet it announces
+        if (pp->len < POSE_HEADER_SIZE || pp->len < (size_t)POSE_HEADER_SIZE + pp->buf[4] + 2) return 0;
+
+        int size = packet_check(pp->buf, pp->len);
+
+        if (size > 0 || size == -3) {
+            uint8_t type = pp->buf[3];
+            size_t whole = POSE_HEADER_SIZE + pp->buf[4] + 2;
+
+            if (size > 0) {
+                pp->payload_len = pp->buf[4];
+                memcpy(pp->payload, pp->buf + POSE_HEADER_SIZE, pp->payload_len);
+            }
+
+            // after a resync there can be bytes of the next packet behind this one
+            memmove(pp->buf, pp->buf + whole, pp->len - whole);
+            pp->len -= whole;
+
+            if (size > 0) {
+                pp->packets++;
+                return type;
+            }
+
+            // a good packet of a version this side doesn't know, skipped whole
+            pp->unknown++;
+            continue;
+        }
+
+        // the bytes after the bad sync may still hold the start of a good packet
+        pp->crc_errors++;
+        parser_resync(pp);
+    }
+
+    return 0;
+}
+
+int packet_parser_push(PacketParser *pp, uint8_t byte, PosePacket *pkt) {
+    int type = packet_parser_feed(pp, byte);
+
+    if (type == PACKET_POSE) return pose_payload_parse(pp->payload, pp->payload_len, pkt) == 0;
+    if (type == PACKET_POSE_COMPACT) return compact_payload_parse(pp->payload, pp->payload_len, pkt) == 0;
+
+    return 0;
+}
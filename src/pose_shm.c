@@ -0,0 +1,105 @@
+#include <pose_shm.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int pose_shm_create(PoseShm *shm, const char *name, uint32_t nslots) {
+    memset(shm, 0, sizeof(PoseShm));
+    if (nslots < 2) nslots = 2;
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("Shared memory: shm_open failed");
+        return -1;
+    }
+
+    shm->map_size = sizeof(PoseShmHeader) + (size_t)nslots * sizeof(PoseShmSlot);
+    if (ftruncate(fd, shm->map_size) != 0) {
+        perror("Shared memory: ftruncate failed");
+        close(fd);
+        return -2;
+    }
+
+    void *map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Shared memory: mmap failed");
+        return -3;
+    }
+
+    shm->header = (PoseShmHeader *)map;
+    shm->slots = (PoseShmSlot *)((uint8_t *)map + sizeof(PoseShmHeader));
+    shm->writer = 1;
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+
+    // a reader still attached from the last run sees the magic go away while the ring is reset
+    __atomic_store_n(&shm->header->magic, 0, __ATOMIC_RELEASE);
+    memset(shm->slots, 0, (size_t)nslots * sizeof(PoseShmSlot));
+    shm->header->version = POSE_SHM_VERSION;
+    shm->header->slot_size = sizeof(PoseShmSlot);
+    shm->header->nslots = nslots;
+    shm->header->head = 0;
+    __atomic_store_n(&shm->header->magic, POSE_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int pose_shm_attach(PoseShm *shm, const char *name) {
+    memset(shm, 0, sizeof(PoseShm));
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return 1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PoseShmHeader)) {
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    shm->header = (PoseShmHeader *)map;
+    shm->slots = (PoseShmSlot *)((uint8_t *)map + sizeof(PoseShmHeader));
+    shm->map_size = st.st_size;
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+
+    if (__atomic_load_n(&shm->header->magic, __ATOMIC_ACQUIRE) != POSE_SHM_MAGIC || shm->header->version != POSE_SHM_VERSION
+        || shm->header->slot_size != sizeof(PoseShmSlot)
+        || sizeof(PoseShmHeader) + (size_t)shm->header->nslots * sizeof(PoseShmSlot) > shm->map_size) {
+        pose_shm_close(shm);
+        return 1;
+    }
+
+    return 0;
+}
+
+int pose_shm_close(PoseShm *shm) {
+    if (shm->header != NULL) munmap(shm->header, shm->map_size);
+    if (shm->writer) shm_unlink(shm->name);
+
+    shm->header = NULL;
+    shm->slots = NULL;
+    return 0;
+}
+
+void pose_shm_write(PoseShm *shm, const uint8_t *data, size_t size) {
+    uint64_t n = shm->header->head;
+    PoseShmSlot *slot = &shm->slots[n % shm->header->nslots];
+
+    // odd first, a reader that gets in between sees the slot change under it
+    __atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->size = size;
+    memcpy(slot->data, data, size);
+
+    __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->header->head, n + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,389 @@
+#include <preprocess.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRE_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PRE_ARM 1
+#endif
+
+#define WB 15
+#define WG 75
+#define WR 38
+
+// reference for any factor, starting at output pixel start
+static void pre_row_scalar(const uint8_t *src, int stride, int factor, uint8_t *dst, int start, int width) {
+    uint32_t n = factor * factor;
+
+    for (int x = start; x < width; x++) {
+        uint32_t s = 0;
+
+        for (int dy = 0; dy < factor; dy++) {
+            const uint8_t *p = src + dy * stride + x * factor * 4;
+            for (int dx = 0; dx < factor; dx++, p += 4) {
+                s += WB * p[0] + WG * p[1] + WR * p[2];
+            }
+        }
+
+        dst[x] = (uint8_t)((s + 64 * n) / (128 * n));
+    }
+}
+
+#ifdef PRE_X86
+
+__attribute__((target("ssse3")))
+static int pre_row1_ssse3(const uint8_t *src, int stride, uint8_t *dst, int width) {
+    const __m128i w = _mm_setr_epi8(WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0);
+    const __m128i round = _mm_set1_epi16(64);
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + x * 4));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + x * 4 + 16));
+
+        // pairs of B+G and R per pixel, then one sum per pixel, at most 255 * 128 so it stays in 16 bits
+        __m128i y = _mm_hadd_epi16(_mm_maddubs_epi16(a, w), _mm_maddubs_epi16(b, w));
+        y = _mm_srli_epi16(_mm_add_epi16(y, round), 7);
+
+        _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(y, y));
+    }
+
+    return x;
+}
+
+// 32 bit weighted sums of 4 pixels
+__attribute__((target("ssse3")))
+static inline __m128i pre_luma4_ssse3(const uint8_t *p) {
+    const __m128i w = _mm_setr_epi8(WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0);
+    return _mm_madd_epi16(_mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)p), w), _mm_set1_epi16(1));
+}
+
+__attribute__((target("ssse3")))
+static int pre_row2_ssse3(const uint8_t *src, int stride, uint8_t *dst, int width) {
+    const __m128i round = _mm_set1_epi32(256);
+    int x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        const uint8_t *p0 = src + x * 8;
+        const uint8_t *p1 = p0 + stride;
+
+        // columns of both rows first, then neighbouring columns, gives the block sums in order
+        __m128i s0 = _mm_add_epi32(pre_luma4_ssse3(p0), pre_luma4_ssse3(p1));
+        __m128i s1 = _mm_add_epi32(pre_luma4_ssse3(p0 + 16), pre_luma4_ssse3(p1 + 16));
+        __m128i o = _mm_srli_epi32(_mm_add_epi32(_mm_hadd_epi32(s0, s1), round), 9);
+
+        o = _mm_packs_epi32(o, o);
+        int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(o, o));
+        memcpy(dst + x, &packed, 4);
+    }
+
+    return x;
+}
+
+__attribute__((target("avx2")))
+static int pre_row1_avx2(const uint8_t *src, int stride, uint8_t *dst, int width) {
+    const __m256i w = _mm256_setr_epi8(
+        WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0,
+        WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0);
+    const __m256i round = _mm256_set1_epi16(64);
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + x * 4 + 32));
+
+        // hadd works per 128 bit lane, which leaves pixels 0-3, 8-11 | 4-7, 12-15
+        __m256i y = _mm256_hadd_epi16(_mm256_maddubs_epi16(a, w), _mm256_maddubs_epi16(b, w));
+        y = _mm256_srli_epi16(_mm256_add_epi16(y, round), 7);
+        y = _mm256_permute4x64_epi64(y, _MM_SHUFFLE(3, 1, 2, 0));
+
+        __m128i out = _mm_packus_epi16(_mm256_castsi256_si128(y), _mm256_extracti128_si256(y, 1));
+        _mm_storeu_si128((__m128i *)(dst + x), out);
+    }
+
+    return x;
+}
+
+// 32 bit weighted sums of 8 pixels
+__attribute__((target("avx2")))
+static inline __m256i pre_luma8_avx2(const uint8_t *p) {
+    const __m256i w = _mm256_setr_epi8(
+        WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0,
+        WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0, WB, WG, WR, 0);
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)p), w), _mm256_set1_epi16(1));
+}
+
+__attribute__((target("avx2")))
+static int pre_row2_avx2(const uint8_t *src, int stride, uint8_t *dst, int width) {
+    const __m256i round = _mm256_set1_epi32(256);
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        const uint8_t *p0 = src + x * 8;
+        const uint8_t *p1 = p0 + stride;
+
+        __m256i s0 = _mm256_add_epi32(pre_luma8_avx2(p0), pre_luma8_avx2(p1));
+        __m256i s1 = _mm256_add_epi32(pre_luma8_avx2(p0 + 32), pre_luma8_avx2(p1 + 32));
+
+        // per lane hadd leaves outputs 0 1 4 5 | 2 3 6 7
+        __m256i o = _mm256_hadd_epi32(s0, s1);
+        o = _mm256_permute4x64_epi64(o, _MM_SHUFFLE(3, 1, 2, 0));
+        o = _mm256_srli_epi32(_mm256_add_epi32(o, round), 9);
+
+        __m128i h = _mm_packs_epi32(_mm256_castsi256_si128(o), _mm256_extracti128_si256(o, 1));
+        _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(h, h));
+    }
+
+    return x;
+}
+
+#endif
+
+#ifdef PRE_ARM
+
+// weighted sums of 8 deinterleaved pixels, at most 255 * 128
+static inline uint16x8_t pre_luma8_neon(uint8x8_t b, uint8x8_t g, uint8x8_t r) {
+    uint16x8_t y = vmull_u8(b, vdup_n_u8(WB));
+    y = vmlal_u8(y, g, vdup_n_u8(WG));
+    return vmlal_u8(y, r, vdup_n_u8(WR));
+}
+
+static int pre_row1_neon(const uint8_t *src, int stride, uint8_t *dst, int width) {
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t v = vld4q_u8(src + x * 4);
+
+        uint16x8_t lo = pre_luma8_neon(vget_low_u8(v.val[0]), vget_low_u8(v.val[1]), vget_low_u8(v.val[2]));
+        uint16x8_t hi = pre_luma8_neon(vget_high_u8(v.val[0]), vget_high_u8(v.val[1]), vget_high_u8(v.val[2]));
+
+        // rounding narrow shift is (y + 64) >> 7
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 7), vrshrn_n_u16(hi, 7)));
+    }
+
+    return x;
+}
+
+static int pre_row2_neon(const uint8_t *src, int stride, uint8_t *dst, int width) {
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        uint8x16x4_t a = vld4q_u8(src + x * 8);
+        uint8x16x4_t b = vld4q_u8(src + x * 8 + stride);
+
+        // both rows fit in 16 bits, the pairwise widening add gives the 2x2 block sums
+        uint16x8_t lo = vaddq_u16(
+            pre_luma8_neon(vget_low_u8(a.val[0]), vget_low_u8(a.val[1]), vget_low_u8(a.val[2])),
+            pre_luma8_neon(vget_low_u8(b.val[0]), vget_low_u8(b.val[1]), vget_low_u8(b.val[2])));
+        uint16x8_t hi = vaddq_u16(
+            pre_luma8_neon(vget_high_u8(a.val[0]), vget_high_u8(a.val[1]), vget_high_u8(a.val[2])),
+            pre_luma8_neon(vget_high_u8(b.val[0]), vget_high_u8(b.val[1]), vget_high_u8(b.val[2])));
+
+        uint32x4_t olo = vrshrq_n_u32(vpaddlq_u16(lo), 9);
+        uint32x4_t ohi = vrshrq_n_u32(vpaddlq_u16(hi), 9);
+
+        vst1_u8(dst + x, vmovn_u16(vcombine_u16(vmovn_u32(olo), vmovn_u32(ohi))));
+    }
+
+    return x;
+}
+
+#endif
+
+const char *preprocess_kernel_name(uint8_t kernel) {
+    switch (kernel) {
+        case PRE_SSSE3: return "SSSE3";
+        case PRE_AVX2: return "AVX2";
+        case PRE_NEON: return "NEON";
+        default: return "scalar";
+    }
+}
+
+// vector kernel for factor, NULL if it isn't compiled in, the CPU lacks it or it has none for factor
+static pre_row_fn pre_kernel_row(uint8_t kernel, uint8_t factor) {
+    if (factor > 2) return NULL;
+
+    switch (kernel) {
+#ifdef PRE_X86
+        case PRE_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2")) return NULL;
+            return factor == 1 ? pre_row1_avx2 : pre_row2_avx2;
+        case PRE_SSSE3:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("ssse3")) return NULL;
+            return factor == 1 ? pre_row1_ssse3 : pre_row2_ssse3;
+#elif defined(PRE_ARM)
+        case PRE_NEON:
+            return factor == 1 ? pre_row1_neon : pre_row2_neon;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+static void pre_select(Preprocessor *pre) {
+    static const uint8_t order[] = { PRE_AVX2, PRE_SSSE3, PRE_NEON };
+
+    pre->kernel = PRE_SCALAR;
+    pre->row = NULL;
+
+    for (size_t i = 0; i < sizeof(order); i++) {
+        pre->row = pre_kernel_row(order[i], pre->factor);
+        if (pre->row != NULL) {
+            pre->kernel = order[i];
+            return;
+        }
+    }
+}
+
+int preprocess_set_kernel(Preprocessor *pre, uint8_t kernel) {
+    if (kernel == PRE_SCALAR) {
+        pre->kernel = PRE_SCALAR;
+        pre->row = NULL;
+        return 0;
+    }
+
+    pre_row_fn row = pre_kernel_row(kernel, pre->factor);
+    if (row == NULL) return 1;
+
+    pre->kernel = kernel;
+    pre->row = row;
+    return 0;
+}
+
+int preprocess_init(Preprocessor *pre, uint8_t factor, uint8_t blur, int max_width) {
+    memset(pre, 0, sizeof(Preprocessor));
+
+    if (factor < 1 || factor > PRE_MAX_FACTOR) {
+        printf("Preprocessing factor %d out of range 1 to %d\n", factor, PRE_MAX_FACTOR);
+        return 1;
+    }
+
+    pre->factor = factor;
+    pre->blur = blur;
+    pre->max_width = max_width > PRE_CHECK_WIDTH ? max_width : PRE_CHECK_WIDTH;
+
+    pre->lines = (uint8_t *)malloc(3 * (size_t)pre->max_width);
+    pre->sums = (uint16_t *)malloc(pre->max_width * sizeof(uint16_t));
+    if (pre->lines == NULL || pre->sums == NULL) {
+        perror("Preprocessing buffer allocation failed");
+        preprocess_destroy(pre);
+        return 2;
+    }
+
+    pre_select(pre);
+    preprocess_self_check(pre);
+
+    return 0;
+}
+
+static void pre_row(Preprocessor *pre, const uint8_t *src, int stride, uint8_t *dst, int width) {
+    int done = pre->row != NULL ? pre->row(src, stride, dst, width) : 0;
+    pre_row_scalar(src, stride, pre->factor, dst, done, width);
+}
+
+// [1 2 1] down the three rows, then across, edges repeat the outermost pixel
+static void pre_blur_row(Preprocessor *pre, const uint8_t *a, const uint8_t *b, const uint8_t *c, uint8_t *dst, int width) {
+    uint16_t *v = pre->sums;
+
+    for (int x = 0; x < width; x++) {
+        v[x] = a[x] + 2 * b[x] + c[x];
+    }
+
+    if (width == 1) {
+        dst[0] = (uint8_t)((4 * v[0] + 8) >> 4);
+        return;
+    }
+
+    dst[0] = (uint8_t)((3 * v[0] + v[1] + 8) >> 4);
+    for (int x = 1; x < width - 1; x++) {
+        dst[x] = (uint8_t)((v[x - 1] + 2 * v[x] + v[x + 1] + 8) >> 4);
+    }
+    dst[width - 1] = (uint8_t)((v[width - 2] + 3 * v[width - 1] + 8) >> 4);
+}
+
+int preprocess_run(Preprocessor *pre, const uint8_t *src, int src_stride, int width, int height, uint8_t *dst, int dst_stride) {
+    if (width > pre->max_width || width < 1 || height < 1) return 1;
+
+    size_t step = (size_t)src_stride * pre->factor;
+
+    if (!pre->blur) {
+        for (int y = 0; y < height; y++) {
+            pre_row(pre, src + y * step, src_stride, dst + (size_t)y * dst_stride, width);
+        }
+        return 0;
+    }
+
+    // row y - 1 is blurred as soon as row y is converted, the lines rotate through three buffers
+    uint8_t *lines[3] = { pre->lines, pre->lines + pre->max_width, pre->lines + 2 * pre->max_width };
+
+    for (int y = 0; y < height; y++) {
+        pre_row(pre, src + y * step, src_stride, lines[y % 3], width);
+
+        if (y >= 1) {
+            uint8_t *above = lines[(y >= 2 ? y - 2 : 0) % 3];
+            pre_blur_row(pre, above, lines[(y - 1) % 3], lines[y % 3], dst + (size_t)(y - 1) * dst_stride, width);
+        }
+    }
+
+    int last = height - 1;
+    uint8_t *above = lines[(last >= 1 ? last - 1 : 0) % 3];
+    pre_blur_row(pre, above, lines[last % 3], lines[last % 3], dst + (size_t)last * dst_stride, width);
+
+    return 0;
+}
+
+int preprocess_self_check(Preprocessor *pre) {
+    if (pre->row == NULL) return 0;
+
+    int w = PRE_CHECK_WIDTH, h = PRE_CHECK_HEIGHT;
+    int stride = w * pre->factor * 4 + 12;
+    uint8_t *src = (uint8_t *)malloc((size_t)stride * h * pre->factor);
+    uint8_t *ref = (uint8_t *)malloc((size_t)w * h);
+    uint8_t *out = (uint8_t *)malloc((size_t)w * h);
+
+    if (src == NULL || ref == NULL || out == NULL) {
+        free(src);
+        free(ref);
+        free(out);
+        return 0;
+    }
+
+    // full range noise plus all white and all black runs to hit the rounding limits
+    uint32_t state = 12345;
+    for (int i = 0; i < stride * h * pre->factor; i++) {
+        state = state * 1103515245 + 12345;
+        src[i] = (uint8_t)(state >> 16);
+    }
+    memset(src, 0xff, stride);
+    memset(src + stride * (h * pre->factor - 1), 0, stride);
+
+    pre_row_fn row = pre->row;
+    preprocess_run(pre, src, stride, w, h, out, w);
+    pre->row = NULL;
+    preprocess_run(pre, src, stride, w, h, ref, w);
+    pre->row = row;
+
+    int mismatch = memcmp(out, ref, (size_t)w * h) != 0;
+    if (mismatch) {
+        printf("Preprocessing %s kernel doesn't match the reference, using the scalar one\n", preprocess_kernel_name(pre->kernel));
+        pre->kernel = PRE_SCALAR;
+        pre->row = NULL;
+    }
+
+    free(src);
+    free(ref);
+    free(out);
+
+    return mismatch;
+}
+
+void preprocess_destroy(Preprocessor *pre) {
+    free(pre->lines);
+    free(pre->sums);
+
+    pre->lines = NULL;
+    pre->sums = NULL;
+}
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE // for versionsort
+#include <replay.h>
+
+// reads one unsigned number from a PNM header, skipping whitespace and comments
+static int read_pnm_number(FILE *f, int *value) {
+    int c = fgetc(f);
+
+    while (c != EOF) {
+        if (c == '#') {
+            while (c != EOF && c != '\n') c = fgetc(f);
+        }
+        else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+            break;
+        }
+        c = fgetc(f);
+    }
+
+    if (c < '0' || c > '9') return -1;
+
+    *value = 0;
+    while (c >= '0' && c <= '9') {
+        *value = *value * 10 + (c - '0');
+        c = fgetc(f);
+    }
+
+    // c is the single whitespace character that ends the number, which is also the end of the header
+    return 0;
+}
+
+// opens a binary gray PNM (P5) and leaves the file at the start of the pixel data
+static FILE *open_pnm(const char *path, int *width, int *height) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+
+    int maxval;
+    if (fgetc(f) != 'P' || fgetc(f) != '5' ||
+            read_pnm_number(f, width) || read_pnm_number(f, height) || read_pnm_number(f, &maxval) ||
+            maxval != 255) {
+        fprintf(stderr, "Replay: %s is not an 8 bit binary PNM\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+static int filter_pnm(const struct dirent *entry) {
+    const char *ext = strrchr(entry->d_name, '.');
+    return ext != NULL && (strcmp(ext, ".pnm") == 0 || strcmp(ext, ".pgm") == 0);
+}
+
+// the raw recording is a fixed size header followed by fixed size records
+static long raw_record_offset(ReplaySet *rs, int index) {
+    return (long)sizeof(RawHeader) + (long)index * ((long)sizeof(int64_t) + (long)rs->width * rs->height);
+}
+
+// timestamp of a frame in us, relative to nothing in particular
+static gint64 replay_timestamp(ReplaySet *rs, int index) {
+    if (rs->mode == SOURCE_PNM_DIR) return index * rs->period;
+
+    int64_t ts = 0;
+    if (fseek(rs->file, raw_record_offset(rs, index), SEEK_SET) != 0 || fread(&ts, sizeof(ts), 1, rs->file) != 1) {
+        return 0;
+    }
+
+    return ts;
+}
+
+// monotonic time in us when a frame is due in real-time playback
+static gint64 replay_due(ReplaySet *rs, int index) {
+    return rs->start + replay_timestamp(rs, index) - rs->first;
+}
+
+// reads a frame's pixels into a pool buffer with the pool stride
+static int replay_load(ReplaySet *rs, int index, uint8_t *buf) {
+    FILE *f;
+
+    if (rs->mode == SOURCE_PNM_DIR) {
+        char path[2 * PLEN + 256];
+        int width, height;
+
+        snprintf(path, sizeof(path), "%s/%s", rs->dir, rs->names[index]->d_name);
+        f = open_pnm(path, &width, &height);
+        if (f == NULL) return 1;
+
+        if (width != rs->width || height != rs->height) {
+            fprintf(stderr, "Replay: %s is %dx%d, expected %dx%d\n", path, width, height, rs->width, rs->height);
+            fclose(f);
+            return 2;
+        }
+    }
+    else {
+        f = rs->file;
+        if (fseek(f, raw_record_offset(rs, index) + (long)sizeof(int64_t), SEEK_SET) != 0) return 1;
+    }
+
+    int ec = 0;
+    for (int y = 0; y < rs->height; y++) {
+        if (fread(buf + y * rs->stride, 1, rs->width, f) != (size_t)rs->width) {
+            ec = 3;
+            break;
+        }
+    }
+
+    if (rs->mode == SOURCE_PNM_DIR) fclose(f);
+
+    return ec;
+}
+
+int replay_open(ReplaySet *rs, Settings *settings) {
+    memset(rs, 0, sizeof(ReplaySet));
+
+    rs->mode = settings->source_mode;
+    rs->realtime = settings->replay_realtime;
+    rs->loop = settings->replay_loop;
+    rs->period = G_TIME_SPAN_SECOND / settings->framerate;
+
+    if (rs->mode == SOURCE_PNM_DIR) {
+        snprintf(rs->dir, sizeof(rs->dir), "%s", settings->replay_path);
+
+        rs->count = scandir(rs->dir, &rs->names, filter_pnm, versionsort);
+        if (rs->count <= 0) {
+            fprintf(stderr, "Replay: no PNM frames found in %s\n", rs->dir);
+            return 1;
+        }
+
+        // the first frame decides the size of every frame
+        char path[2 * PLEN + 256];
+        snprintf(path, sizeof(path), "%s/%s", rs->dir, rs->names[0]->d_name);
+
+        FILE *f = open_pnm(path, &rs->width, &rs->height);
+        if (f == NULL) return 2;
+        fclose(f);
+    }
+    else if (rs->mode == SOURCE_RAW_FILE) {
+        RawHeader header;
+
+        rs->file = fopen(settings->replay_path, "rb");
+        if (rs->file == NULL) {
+            perror("Replay: Unable to open raw recording");
+            return 1;
+        }
+
+        if (fread(&header, sizeof(header), 1, rs->file) != 1 || memcmp(header.magic, RAW_MAGIC, sizeof(header.magic)) != 0) {
+            fprintf(stderr, "Replay: %s is not a raw recording\n", settings->replay_path);
+            return 2;
+        }
+
+        rs->width = header.width;
+        rs->height = header.height;
+
+        // records are fixed size, so the count follows from the file size
+        fseek(rs->file, 0, SEEK_END);
+        rs->count = (ftell(rs->file) - (long)sizeof(RawHeader)) / (raw_record_offset(rs, 1) - raw_record_offset(rs, 0));
+        if (rs->count <= 0) {
+            fprintf(stderr, "Replay: %s has no frames\n", settings->replay_path);
+            return 3;
+        }
+    }
+    else {
+        fprintf(stderr, "Replay: unknown source mode %d\n", rs->mode);
+        return 4;
+    }
+
+    if (rs->width != settings->width || rs->height != settings->height) {
+        printf("Replay: frames are %dx%d but settings give %dx%d, check the calibration\n",
+            rs->width, rs->height, settings->width, settings->height);
+    }
+
+    // rows padded to 16 bytes, like a camera buffer would be
+    rs->stride = (rs->width + 15) & ~15;
+    for (int i = 0; i < REPLAY_BUFFERS; i++) {
+        rs->buffers[i] = (uint8_t *)malloc((size_t)rs->stride * rs->height);
+        if (rs->buffers[i] == NULL) {
+            perror("Replay: buffer allocation failed");
+            return 5;
+        }
+    }
+
+    rs->first = replay_timestamp(rs, 0);
+
+    printf("Replay: %d frames of %dx%d, %s\n", rs->count, rs->width, rs->height, rs->realtime ? "real-time" : "as fast as possible");
+
+    return 0;
+}
+
+int replay_pull_frame(ReplaySet *rs, Frame *frame) {
+    gint64 now = g_get_monotonic_time();
+
+    if (rs->start == 0) rs->start = now;
+
+    if (rs->index >= rs->count) {
+        if (!rs->loop) return 1;
+
+        // begin a new pass with a fresh timeline
+        rs->index = 0;
+        rs->start = now;
+    }
+
+    gint64 timestamp = now;
+
+    if (rs->realtime) {
+        // skip frames whose successor is already due, the same as the camera slot dropping stale samples
+        while (rs->index + 1 < rs->count && replay_due(rs, rs->index + 1) <= now) {
+            rs->index++;
+            rs->received++;
+            rs->dropped++;
+        }
+
+        // wait for the frame's turn
+        timestamp = replay_due(rs, rs->index);
+        if (timestamp > now) {
+            struct timespec ts = {
+                .tv_sec = timestamp / G_TIME_SPAN_SECOND,
+                .tv_nsec = (timestamp % G_TIME_SPAN_SECOND) * 1000
+            };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        }
+    }
+
+    // find a buffer no other frame is holding
+    int b;
+    for (b = 0; b < REPLAY_BUFFERS; b++) {
+        if (__atomic_exchange_n(&rs->busy[b], 1, __ATOMIC_ACQUIRE) == 0) break;
+    }
+    if (b == REPLAY_BUFFERS) return 3;
+
+    int ec = replay_load(rs, rs->index, rs->buffers[b]);
+    rs->index++;
+    rs->received++;
+
+    if (ec) {
+        __atomic_store_n(&rs->busy[b], 0, __ATOMIC_RELEASE);
+        return 2;
+    }
+
+    rs->taken++;
+
+    // image_u8_t has const dimensions, so the view is built and copied over the frame's copy
+    image_u8_t view = {
+        .width = rs->width,
+        .height = rs->height,
+        .stride = rs->stride,
+        .buf = rs->buffers[b]
+    };
+    memcpy(&frame->im, &view, sizeof(image_u8_t));
+
+    frame->sample = NULL;
+    frame->buffer = NULL;
+    frame->hold = &rs->busy[b];
+    frame->seq = rs->received;
+    memset(&frame->times, 0, sizeof(StageTimes));
+    frame->times.capture = timestamp;
+    frame->times.arrival = timestamp;
+    frame->age = g_get_monotonic_time() - timestamp;
+
+    return 0;
+}
+
+int replay_get_stats(ReplaySet *rs, CaptureStats *stats) {
+    stats->received = rs->received;
+    stats->taken = rs->taken;
+    stats->dropped = rs->dropped;
+
+    return 0;
+}
+
+int replay_close(ReplaySet *rs) {
+    if (rs->names != NULL) {
+        for (int i = 0; i < rs->count; i++) free(rs->names[i]);
+        free(rs->names);
+        rs->names = NULL;
+    }
+
+    if (rs->file != NULL) {
+        fclose(rs->file);
+        rs->file = NULL;
+    }
+
+    for (int i = 0; i < REPLAY_BUFFERS; i++) {
+        free(rs->buffers[i]);
+        rs->buffers[i] = NULL;
+    }
+
+    return 0;
+}
+
+int recorder_open(Recorder *rec, const char *path, int width, int height) {
+    rec->file = fopen(path, "wb");
+    if (rec->file == NULL) {
+        perror("Recorder: Unable to open recording");
+        return -1;
+    }
+
+    RawHeader header = { .width = width, .height = height };
+    memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+
+    if (fwrite(&header, sizeof(header), 1, rec->file) != 1) {
+        perror("Recorder: Unable to write header");
+        fclose(rec->file);
+        rec->file = NULL;
+        return -2;
+    }
+
+    rec->width = width;
+    rec->height = height;
+
+    return 0;
+}
+
+int recorder_write(Recorder *rec, image_u8_t *im, gint64 timestamp) {
+    if (rec->file == NULL) return -1;
+
+    if (im->width != rec->width || im->height != rec->height) return -2;
+
+    int64_t ts = timestamp;
+    if (fwrite(&ts, sizeof(ts), 1, rec->file) != 1) return -3;
+
+    // rows are written without the stride padding
+    for (int y = 0; y < im->height; y++) {
+        if (fwrite(im->buf + y * im->stride, 1, im->width, rec->file) != (size_t)im->width) return -3;
+    }
+
+    return 0;
+}
+
+int recorder_close(Recorder *rec) {
+    if (rec->file == NULL) return 0;
+
+    if (fclose(rec->file) != 0) {
+        perror("Recorder: Unable to close recording");
+        rec->file = NULL;
+        return -1;
+    }
+
+    rec->file = NULL;
+    return 0;
+}
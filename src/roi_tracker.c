@@ -0,0 +1,180 @@
+#include <roi_tracker.h>
+
+int roi_tracker_init(ROITracker *tracker, Settings *settings) {
+    memset(tracker, 0, sizeof(ROITracker));
+
+    tracker->margin = settings->roi_margin;
+    tracker->full_interval = settings->roi_full_interval;
+    tracker->use_velocity = settings->roi_velocity;
+
+    return 0;
+}
+
+static int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static int roi_overlap(ROI *a, ROI *b) {
+    return a->x0 < b->x1 && b->x0 < a->x1 && a->y0 < b->y1 && b->y0 < a->y1;
+}
+
+// region around where a tag should be at time t, returns 0 if none of it is in the frame
+static int roi_predict(ROITracker *tracker, TrackedTag *tag, int64_t t, int width, int height, ROI *roi) {
+    double dx = 0, dy = 0;
+    if (tracker->use_velocity) {
+        dx = tag->v[0] * (double)(t - tag->t);
+        dy = tag->v[1] * (double)(t - tag->t);
+    }
+
+    double xmin = tag->p[0][0], xmax = tag->p[0][0];
+    double ymin = tag->p[0][1], ymax = tag->p[0][1];
+    for (int i = 1; i < 4; i++) {
+        if (tag->p[i][0] < xmin) xmin = tag->p[i][0];
+        if (tag->p[i][0] > xmax) xmax = tag->p[i][0];
+        if (tag->p[i][1] < ymin) ymin = tag->p[i][1];
+        if (tag->p[i][1] > ymax) ymax = tag->p[i][1];
+    }
+
+    double size = (xmax - xmin) > (ymax - ymin) ? (xmax - xmin) : (ymax - ymin);
+    double grow = tracker->margin * size + ROI_PAD;
+
+    int x0 = (int)(xmin + dx - grow);
+    int y0 = (int)(ymin + dy - grow);
+    int x1 = (int)(xmax + dx + grow) + 1;
+    int y1 = (int)(ymax + dy + grow) + 1;
+
+    // tiny regions leave the detector nothing to threshold against
+    if (x1 - x0 < ROI_MIN_SIZE) {
+        x0 = (x0 + x1 - ROI_MIN_SIZE) / 2;
+        x1 = x0 + ROI_MIN_SIZE;
+    }
+    if (y1 - y0 < ROI_MIN_SIZE) {
+        y0 = (y0 + y1 - ROI_MIN_SIZE) / 2;
+        y1 = y0 + ROI_MIN_SIZE;
+    }
+
+    roi->x0 = clamp_int(x0, 0, width);
+    roi->y0 = clamp_int(y0, 0, height);
+    roi->x1 = clamp_int(x1, 0, width);
+    roi->y1 = clamp_int(y1, 0, height);
+
+    return roi->x1 > roi->x0 && roi->y1 > roi->y0;
+}
+
+int roi_tracker_plan(ROITracker *tracker, int64_t t, int width, int height, ROI *rois) {
+    if (tracker->ntags == 0 || tracker->since_full >= tracker->full_interval) return 0;
+
+    int nrois = 0;
+    for (int i = 0; i < tracker->ntags; i++) {
+        // a tag predicted to leave the frame goes missing and triggers a full search
+        if (roi_predict(tracker, &tracker->tags[i], t, width, height, &rois[nrois])) nrois++;
+    }
+
+    // overlapping regions would find the same tags twice, merge them until none overlap
+    for (int i = 0; i < nrois; i++) {
+        for (int j = i + 1; j < nrois; j++) {
+            if (!roi_overlap(&rois[i], &rois[j])) continue;
+
+            if (rois[j].x0 < rois[i].x0) rois[i].x0 = rois[j].x0;
+            if (rois[j].y0 < rois[i].y0) rois[i].y0 = rois[j].y0;
+            if (rois[j].x1 > rois[i].x1) rois[i].x1 = rois[j].x1;
+            if (rois[j].y1 > rois[i].y1) rois[i].y1 = rois[j].y1;
+
+            rois[j] = rois[--nrois];
+            j = i; // the grown region may now overlap ones already checked
+        }
+    }
+
+    // past half the frame the regions save less than searching it whole once
+    int64_t area = 0;
+    for (int i = 0; i < nrois; i++) {
+        area += (int64_t)(rois[i].x1 - rois[i].x0) * (rois[i].y1 - rois[i].y0);
+    }
+    if (area * 2 > (int64_t)width * height) return 0;
+
+    return nrois;
+}
+
+static TrackedTag *roi_find(ROITracker *tracker, int id) {
+    for (int i = 0; i < tracker->ntags; i++) {
+        if (tracker->tags[i].id == id) return &tracker->tags[i];
+    }
+
+    return NULL;
+}
+
+int roi_tracker_missing(ROITracker *tracker, zarray_t *detections) {
+    int missing = 0;
+
+    for (int i = 0; i < tracker->ntags; i++) {
+        int found = 0;
+
+        for (int j = 0; j < zarray_size(detections) && !found; j++) {
+            apriltag_detection_t *d;
+            zarray_get(detections, j, &d);
+            found = d->id == tracker->tags[i].id;
+        }
+
+        if (!found) missing++;
+    }
+
+    return missing;
+}
+
+int roi_tracker_update(ROITracker *tracker, zarray_t *detections, int64_t t, uint8_t full) {
+    TrackedTag tags[MAX_TRACKED];
+    int ntags = 0;
+
+    for (int i = 0; i < zarray_size(detections) && ntags < MAX_TRACKED; i++) {
+        apriltag_detection_t *d;
+        zarray_get(detections, i, &d);
+
+        TrackedTag *tag = &tags[ntags++];
+        tag->id = d->id;
+        tag->t = t;
+        memcpy(tag->p, d->p, sizeof(tag->p));
+        tag->c[0] = d->c[0];
+        tag->c[1] = d->c[1];
+
+        // velocity from the last time this tag was seen, other detectors may have had the frames in between
+        TrackedTag *prev = roi_find(tracker, d->id);
+        if (prev != NULL && t > prev->t) {
+            tag->v[0] = (tag->c[0] - prev->c[0]) / (double)(t - prev->t);
+            tag->v[1] = (tag->c[1] - prev->c[1]) / (double)(t - prev->t);
+        }
+        else {
+            tag->v[0] = 0;
+            tag->v[1] = 0;
+        }
+    }
+
+    memcpy(tracker->tags, tags, ntags * sizeof(TrackedTag));
+    tracker->ntags = ntags;
+
+    if (full) {
+        tracker->since_full = 0;
+        tracker->full_searches++;
+    }
+    else {
+        tracker->since_full++;
+        tracker->roi_searches++;
+    }
+
+    return 0;
+}
+
+void roi_shift_detection(apriltag_detection_t *det, int x0, int y0) {
+    det->c[0] += x0;
+    det->c[1] += y0;
+
+    for (int i = 0; i < 4; i++) {
+        det->p[i][0] += x0;
+        det->p[i][1] += y0;
+    }
+
+    // H maps tag coordinates to region pixels, adding the offset times the homogeneous row maps them to frame pixels
+    for (int j = 0; j < 3; j++) {
+        MATD_EL(det->H, 0, j) += x0 * MATD_EL(det->H, 2, j);
+        MATD_EL(det->H, 1, j) += y0 * MATD_EL(det->H, 2, j);
+    }
+}
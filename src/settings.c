@@ -98,23 +98,65 @@ int load_settings_from_path(const char* path, Settings *settings) {
     // #TODO: create macro to parse aspect ratio
     PARSE_INT(framerate);
     PARSE_INT(stride);
+    PARSE_INT(capture_mode);
+    PARSE_INT(prescale);
+    PARSE_BOOL(pre_blur);
+
+    PARSE_INT(source_mode);
+    (*settings).replay_path = (char*)malloc(PLEN);
+    PARSE_STRING(replay_path);
+    PARSE_BOOL(replay_realtime);
+    PARSE_BOOL(replay_loop);
+    (*settings).record_path = (char*)malloc(PLEN);
+    PARSE_STRING(record_path);
+
+    PARSE_INT(queue_depth);
+    PARSE_INT(queue_policy);
 
     PARSE_BOOL(debug);
     PARSE_BOOL(quiet);
     PARSE_INT(iterations);
     PARSE_INT(hamming);
+    (*settings).decoder_cache = (char*)malloc(PLEN);
+    PARSE_STRING(decoder_cache);
     PARSE_INT(threads);
+    PARSE_INT(detectors);
 
     // #TODO: find actual minimum and maximum values or redefine macro for no limits
     PARSE_DOUBLE_MIN_MAX(dec, 0.0f, 4.0f);
     PARSE_DOUBLE_MIN_MAX(blur, -1.0f, 1.0f);
     PARSE_BOOL(refine);
+
+    PARSE_BOOL(adaptive_tuning);
+    PARSE_INT(detect_budget_us);
+    PARSE_DOUBLE_MIN_MAX(dec_min, 1.0f, 8.0f);
+    PARSE_DOUBLE_MIN_MAX(dec_max, 1.0f, 8.0f);
+
+    PARSE_BOOL(roi_tracking);
+    PARSE_DOUBLE_MIN_MAX(roi_margin, 0.0f, 4.0f);
+    PARSE_INT(roi_full_interval);
+    PARSE_BOOL(roi_velocity);
+    PARSE_BOOL(joint_pose);
+    PARSE_BOOL(warm_pose);
+    PARSE_DOUBLE_MIN_MAX(warm_max_jump, 0.001f, 10.0f);
+
+    PARSE_BOOL(kalman_filter);
+    PARSE_INT(kf_rate);
+    PARSE_INT(kf_max_predict);
+    PARSE_DOUBLE_MIN_MAX(kf_accel_noise, 0.001f, 100.0f);
+    PARSE_DOUBLE_MIN_MAX(kf_pos_noise, 0.0001f, 1.0f);
+    PARSE_DOUBLE_MIN_MAX(kf_ang_accel_noise, 0.001f, 100.0f);
+    PARSE_DOUBLE_MIN_MAX(kf_att_noise, 0.0001f, 1.0f);
     PARSE_INT(tag_family);
     PARSE_DOUBLE_MIN_MAX(tag_size, 0.01f, 1.0f);
 
     (*settings).output_directory = (char*)malloc(PLEN);
     PARSE_STRING(output_directory);
 
+    PARSE_BOOL(log_binary);
+    PARSE_INT(log_records);
+    PARSE_INT(log_sync_ms);
+
     (*settings).cal_file_path = (char*)malloc(PLEN);
     PARSE_STRING(cal_file_path);
 
@@ -170,9 +212,32 @@ int load_settings_from_path(const char* path, Settings *settings) {
         PARSE_INT(center_id);
     }
 
+    (*settings).tag_map_path = (char*)malloc(PLEN);
+    PARSE_STRING(tag_map_path);
+    (*settings).tag_map_save_path = (char*)malloc(PLEN);
+    PARSE_STRING(tag_map_save_path);
+
     (*settings).uart_path = (char*)malloc(PLEN);
     PARSE_STRING(uart_path);
     PARSE_INT(uart_baudrate);
+    PARSE_INT(uart_report_ms);
+    PARSE_BOOL(clock_sync);
+    PARSE_INT(sync_interval_ms);
+    PARSE_DOUBLE_MIN_MAX(attitude_gate_deg, 0.0f, 180.0f);
+
+    PARSE_BOOL(output_uart);
+    PARSE_BOOL(output_udp);
+    (*settings).udp_host = (char*)malloc(PLEN);
+    PARSE_STRING(udp_host);
+    PARSE_INT(udp_port);
+    PARSE_BOOL(output_unix);
+    (*settings).unix_socket_path = (char*)malloc(PLEN);
+    PARSE_STRING(unix_socket_path);
+    PARSE_BOOL(output_shm);
+    (*settings).shm_name = (char*)malloc(PLEN);
+    PARSE_STRING(shm_name);
+    PARSE_INT(shm_slots);
+    PARSE_BOOL(compact_pose);
 
     json_object_put(jobj);
     return 0;
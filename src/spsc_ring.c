@@ -0,0 +1,85 @@
+#define _GNU_SOURCE // for sem_clockwait
+#include <spsc_ring.h>
+
+// waits on a semaphore for at most timeout_us, 0 only tries
+static int sem_wait_us(sem_t *sem, int64_t timeout_us) {
+    if (timeout_us <= 0) return sem_trywait(sem);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout_us / 1000000;
+    ts.tv_nsec += (timeout_us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    int ec;
+    while ((ec = sem_clockwait(sem, CLOCK_MONOTONIC, &ts)) == -1 && errno == EINTR);
+
+    return ec;
+}
+
+int ring_init(SPSCRing *ring, uint32_t capacity, size_t slot_size, uint8_t policy) {
+    memset(ring, 0, sizeof(SPSCRing));
+
+    if (capacity == 0) return -1;
+
+    ring->slots = (uint8_t *)calloc(capacity, slot_size);
+    if (ring->slots == NULL) {
+        perror("Ring: slot allocation failed");
+        return -2;
+    }
+
+    ring->slot_size = slot_size;
+    ring->capacity = capacity;
+    ring->policy = policy;
+
+    sem_init(&ring->items, 0, 0);
+    sem_init(&ring->spaces, 0, capacity);
+
+    return 0;
+}
+
+void *ring_claim(SPSCRing *ring, int64_t timeout_us) {
+    if (sem_wait_us(&ring->spaces, ring->policy == QUEUE_DROP ? 0 : timeout_us) != 0) {
+        if (ring->policy == QUEUE_DROP) ring->dropped++;
+        return NULL;
+    }
+
+    return ring->slots + (ring->tail % ring->capacity) * ring->slot_size;
+}
+
+void ring_publish(SPSCRing *ring) {
+    ring->tail++;
+    ring->pushed++;
+    sem_post(&ring->items);
+}
+
+void *ring_peek(SPSCRing *ring, int64_t timeout_us) {
+    if (sem_wait_us(&ring->items, timeout_us) != 0) return NULL;
+
+    return ring->slots + (ring->head % ring->capacity) * ring->slot_size;
+}
+
+void ring_release(SPSCRing *ring) {
+    ring->head++;
+    sem_post(&ring->spaces);
+}
+
+int ring_count(SPSCRing *ring) {
+    int count;
+    sem_getvalue(&ring->items, &count);
+
+    return count;
+}
+
+int ring_destroy(SPSCRing *ring) {
+    sem_destroy(&ring->items);
+    sem_destroy(&ring->spaces);
+
+    free(ring->slots);
+    ring->slots = NULL;
+
+    return 0;
+}
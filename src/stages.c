@@ -0,0 +1,591 @@
+#include <stages.h>
+
+static int stage_running(Stages *st) {
+    return __atomic_load_n(&st->running, __ATOMIC_ACQUIRE);
+}
+
+static void stage_exit(Stages *st, int stage) {
+    __atomic_store_n(&st->done[stage], 1, __ATOMIC_RELEASE);
+}
+
+// waits for the next input, returns NULL once the stage should exit
+static void *stage_next(Stages *st, SPSCRing *in, int upstream) {
+    while (stage_running(st)) {
+        void *slot = ring_peek(in, STAGE_POLL_US);
+        if (slot != NULL) return slot;
+
+        // upstream publishes before it exits, so an empty ring after that means nothing else is coming
+        if (__atomic_load_n(&st->done[upstream], __ATOMIC_ACQUIRE) && ring_count(in) == 0) return NULL;
+    }
+
+    return NULL;
+}
+
+// claims an output slot, waiting on a QUEUE_BLOCK ring for as long as the stages run
+static void *stage_claim(Stages *st, SPSCRing *out) {
+    while (stage_running(st)) {
+        void *slot = ring_claim(out, STAGE_POLL_US);
+        if (slot != NULL || out->policy == QUEUE_DROP) return slot;
+    }
+
+    return NULL;
+}
+
+// adds the calling thread's allocations since its last frame, once it is past warm up
+// base is the thread's count at its previous frame, nframes the frames it has handled
+static void stage_allocs(Stages *st, int stage, uint64_t *nframes, uint64_t *base) {
+    if (!alloc_count_enabled()) return;
+
+    uint64_t count = alloc_count_thread();
+    if (++(*nframes) > ALLOC_WARMUP_FRAMES) {
+        __atomic_add_fetch(&st->allocs[stage], count - *base, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&st->alloc_frames[stage], 1, __ATOMIC_RELAXED);
+    }
+    *base = count;
+}
+
+// creates the pose matrices of every detection slot once, so detection only writes into them
+static int alloc_detect_poses(SPSCRing *ring) {
+    for (uint32_t i = 0; i < ring->capacity; i++) {
+        DetectSlot *det = (DetectSlot *)(ring->slots + i * ring->slot_size);
+
+        for (int j = 0; j < MAX_DETECTIONS; j++) {
+            det->poses[j].R = matd_create(3, 3);
+            det->poses[j].t = matd_create(3, 1);
+            if (det->poses[j].R == NULL || det->poses[j].t == NULL) return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void free_detect_poses(SPSCRing *ring) {
+    for (uint32_t i = 0; i < ring->capacity; i++) {
+        DetectSlot *det = (DetectSlot *)(ring->slots + i * ring->slot_size);
+
+        for (int j = 0; j < MAX_DETECTIONS; j++) {
+            matd_destroy(det->poses[j].R);
+            matd_destroy(det->poses[j].t);
+        }
+    }
+}
+
+// pulls frames from the camera slot or the replay and deals them out to the detector instances in turn
+// a frame is only pulled once the instance whose turn it is has room for it
+static void *capture_stage(void *arg) {
+    Stages *st = (Stages *)arg;
+    Frame *frame = NULL;
+    int next = 0;
+    uint64_t nframes = 0, base = 0;
+    int ec;
+
+    while (stage_running(st)) {
+        // keep the claimed slot across failed pulls
+        if (frame == NULL) frame = (Frame *)stage_claim(st, &st->workers[next].frames);
+        if (frame == NULL) continue;
+
+        if (st->settings->source_mode == SOURCE_CAMERA) {
+            ec = gstream_pull_frame(st->streams, frame, st->settings);
+        }
+        else {
+            ec = replay_pull_frame(st->replay, frame);
+            if (ec == 1) {
+                printf("Replay finished\n");
+                break;
+            }
+        }
+        if (ec) continue;
+
+        if (st->recorder->file != NULL) recorder_write(st->recorder, &frame->im, frame->times.capture);
+
+        if (!st->settings->quiet) printf("Frame %llu, age %lld us\n", (unsigned long long)frame->seq, (long long)frame->age);
+
+        ring_publish(&st->workers[next].frames);
+        frame = NULL;
+        next = (next + 1) % st->nworkers;
+
+        stage_allocs(st, STAGE_CAPTURE, &nframes, &base);
+    }
+
+    stage_exit(st, STAGE_CAPTURE);
+    return NULL;
+}
+
+// runs one detector instance, the frame is held in its ring slot until detection is done and then released
+static void *detect_stage(void *arg) {
+    DetectWorker *w = (DetectWorker *)arg;
+    Stages *st = w->st;
+    Frame *frame;
+    ROITracker *tracker = st->settings->roi_tracking ? &w->tracker : NULL;
+    PoseTracker *warm = st->settings->warm_pose ? &w->poses : NULL;
+    uint64_t nframes = 0, base = 0;
+
+    while ((frame = (Frame *)stage_next(st, &w->frames, STAGE_CAPTURE)) != NULL) {
+        // every frame gets a result, a missing one would shift the order the transform stage reads them in
+        DetectSlot *det = (DetectSlot *)stage_claim(st, &w->detections);
+
+        if (det != NULL) {
+            det->seq = frame->seq;
+            det->times = frame->times;
+            det->status = apriltag_detect(w->td, &frame->im, &w->info, det->poses, st->settings, tracker, warm, st->map, det->ids, &det->nids, &det->err, &det->times, w->index);
+
+            // td is only used by this thread, so it can change between its frames
+            if (st->settings->adaptive_tuning) {
+                tuner_update(&w->tuner, w->td, det->poses, det->nids, det->status, det->times.detect_end - det->times.detect_start);
+            }
+        }
+
+        gstream_release_frame(frame);
+        ring_release(&w->frames);
+
+        // only happens when stopping
+        if (det == NULL) continue;
+
+        if (det->status) {
+            printf("Apriltag detection returned error code: %d\n", det->status);
+        }
+
+        ring_publish(&w->detections);
+
+        // every instance adds to the same count, it is per frame either way
+        stage_allocs(st, STAGE_DETECT, &nframes, &base);
+    }
+
+    // the last instance to exit marks the whole stage done
+    if (__atomic_sub_fetch(&st->detect_running, 1, __ATOMIC_ACQ_REL) == 0) stage_exit(st, STAGE_DETECT);
+    return NULL;
+}
+
+// true when no detector instance has a result waiting
+static int detections_empty(Stages *st) {
+    for (int i = 0; i < st->nworkers; i++) {
+        if (ring_count(&st->workers[i].detections) != 0) return 0;
+    }
+
+    return 1;
+}
+
+// true if the camera turned through a different angle than the controller since the last pose that passed
+// the angle of a relative rotation doesn't depend on the frame, so neither the map nor the mounting matter
+static int attitude_gated(Stages *st, Quat *last_q, int64_t last_time, Quat *q, int64_t time) {
+    double imu_angle;
+
+    if (st->uart_link == NULL || st->settings->attitude_gate_deg <= 0) return 0;
+    if (last_time == 0 || time - last_time > ATTITUDE_GATE_SPAN) return 0;
+    if (uart_link_attitude_delta(st->uart_link, last_time, time, &imu_angle)) return 0;
+
+    Quat c = quat_conj(last_q);
+    Quat d = quat_mul(&c, q);
+    Vec3 r = quat_log(&d);
+
+    return fabs(vec3_norm(&r) - imu_angle) > st->settings->attitude_gate_deg * M_PI / 180.0;
+}
+
+// turns per-tag poses into the grid pose, frames without detections stop here
+// results are read from the detector instances in the order frames were dealt, which puts them back in sequence
+static void *transform_stage(void *arg) {
+    Stages *st = (Stages *)arg;
+    DetectSlot *det;
+    int next = 0;
+    uint64_t nframes = 0, base = 0;
+    Vec3 p;
+    Quat q, last_q;
+    int64_t last_time = 0;
+    int gated = 0; // in a row since the last pose that passed
+    int ec;
+
+    while (stage_running(st)) {
+        DetectWorker *w = &st->workers[next];
+
+        det = (DetectSlot *)ring_peek(&w->detections, STAGE_POLL_US);
+        if (det == NULL) {
+            if (__atomic_load_n(&st->done[STAGE_DETECT], __ATOMIC_ACQUIRE) && detections_empty(st)) break;
+            continue;
+        }
+
+        // worked out before a slot is claimed, a claimed slot has to be published and a gated pose isn't
+        StageTimes times = det->times;
+        ec = det->status == 0 ? pose_transform(&p, &q, det->poses, st->map, det->ids, det->nids, &times) : 1;
+        if (det->status == 0 && ec) {
+            printf("Pose transformation returned error code: %d\n", ec);
+        }
+
+        if (ec == 0 && attitude_gated(st, &last_q, last_time, &q, det->times.capture)) {
+            st->gated++;
+            ec = 1;
+
+            // one bad pose let through would otherwise gate every good one after it until the span runs out
+            // this one is still dropped, the next is compared against it
+            if (++gated >= ATTITUDE_GATE_RESET) {
+                last_q = q;
+                last_time = det->times.capture;
+                gated = 0;
+                st->gate_resets++;
+            }
+        }
+
+        if (ec == 0) {
+            gated = 0;
+            last_q = q;
+            last_time = det->times.capture;
+
+            PoseSlot *pose = (PoseSlot *)stage_claim(st, &st->poses);
+
+            if (pose != NULL) {
+                pose->seq = det->seq;
+                pose->times = times;
+                pose->time = det->times.capture;
+                pose->predicted = 0;
+                pose->nids = det->nids;
+                memcpy(pose->ids, det->ids, det->nids * sizeof(int));
+                pose->p = p;
+                pose->q = q;
+                pose_uncertainty(st->settings, &det->poses[0], &q, det->err, det->nids, pose->pos_sigma, pose->att_sigma);
+
+                ring_publish(&st->poses);
+            }
+        }
+
+        ring_release(&w->detections);
+        next = (next + 1) % st->nworkers;
+
+        stage_allocs(st, STAGE_TRANSFORM, &nframes, &base);
+    }
+
+    stage_exit(st, STAGE_TRANSFORM);
+    return NULL;
+}
+
+// claims an estimate slot and fills in everything but the pose, returns NULL if it was dropped
+static PoseSlot *filter_claim(Stages *st, uint64_t seq, int64_t time, uint8_t predicted) {
+    PoseSlot *out = (PoseSlot *)stage_claim(st, &st->estimates);
+    if (out == NULL) return NULL;
+
+    out->seq = seq;
+    out->time = time;
+    out->predicted = predicted;
+    return out;
+}
+
+// filters measured poses and sends them on straight away, in between it sends the pose predicted
+// to the current time at kf_rate, until kf_max_predict after the last measurement
+static void *filter_stage(void *arg) {
+    Stages *st = (Stages *)arg;
+    PoseFilter *pf = &st->filter;
+    int64_t period = st->settings->kf_rate > 0 ? 1000000 / st->settings->kf_rate : 0;
+    int64_t next_tick = monotonic_us() + period;
+    uint64_t seq = 0;
+    uint64_t nframes = 0, base = 0;
+
+    while (stage_running(st)) {
+        int64_t now = monotonic_us();
+        int64_t wait = period > 0 ? next_tick - now : STAGE_POLL_US;
+
+        PoseSlot *pose = (PoseSlot *)ring_peek(&st->poses, wait);
+        if (pose != NULL) {
+            pose_filter_update(pf, &pose->p, &pose->q, pose->time);
+            seq = pose->seq;
+
+            PoseSlot *out = filter_claim(st, seq, pose->time, 0);
+            if (out != NULL) {
+                out->times = pose->times;
+                out->p = pose->p;
+                out->q = pose->q;
+                pose_filter_sigma(pf, pose->time, out->pos_sigma, out->att_sigma);
+                out->nids = pose->nids;
+                memcpy(out->ids, pose->ids, pose->nids * sizeof(int));
+                ring_publish(&st->estimates);
+            }
+
+            ring_release(&st->poses);
+            stage_allocs(st, STAGE_FILTER, &nframes, &base);
+        }
+        else if (__atomic_load_n(&st->done[STAGE_TRANSFORM], __ATOMIC_ACQUIRE) && ring_count(&st->poses) == 0) {
+            break;
+        }
+
+        now = monotonic_us();
+        if (period == 0 || now < next_tick) continue;
+
+        // a late tick is skipped rather than sent twice in a row
+        next_tick += period;
+        if (next_tick <= now) next_tick = now + period;
+
+        Vec3 p;
+        Quat q;
+        if (pose_filter_predict(pf, now, &p, &q)) continue;
+
+        PoseSlot *out = filter_claim(st, seq, now, 1);
+        if (out != NULL) {
+            memset(&out->times, 0, sizeof(StageTimes));
+            out->times.transform = now;
+            out->p = p;
+            out->q = q;
+            pose_filter_sigma(pf, now, out->pos_sigma, out->att_sigma);
+            out->nids = 0;
+            ring_publish(&st->estimates);
+            st->predicted++;
+        }
+    }
+
+    stage_exit(st, STAGE_FILTER);
+    return NULL;
+}
+
+// hands poses to the UART writer, which does the serial I/O on its own thread
+static void *transmit_stage(void *arg) {
+    Stages *st = (Stages *)arg;
+    PoseSlot *pose;
+    PosePacket pkt;
+    uint16_t seq = 0; // per packet, so the receiver sees every lost one
+    uint64_t nframes = 0, base = 0;
+    int ec;
+
+    // poses come from the filter when it runs, straight from the transform stage otherwise
+    SPSCRing *in = st->settings->kalman_filter ? &st->estimates : &st->poses;
+    int upstream = st->settings->kalman_filter ? STAGE_FILTER : STAGE_TRANSFORM;
+
+    while ((pose = (PoseSlot *)stage_next(st, in, upstream)) != NULL) {
+        uint8_t flags = 0;
+        if (pose->predicted) flags |= POSE_FLAG_PREDICTED;
+        if (st->settings->kalman_filter) flags |= POSE_FLAG_FILTERED;
+        if (st->settings->joint_pose && pose->nids > 1) flags |= POSE_FLAG_JOINT;
+
+        // on the controller's clock once the link knows the offset, so it can line the pose up with its IMU
+        int64_t time = pose->time;
+        if (st->uart_link != NULL && uart_link_remote_time(st->uart_link, pose->time, &time) == 0) {
+            flags |= POSE_FLAG_REMOTE_TIME;
+        }
+
+        pose_packet_fill(&pkt, seq++, &pose->p, &pose->q, time, pose->nids, flags);
+        memcpy(pkt.pos_sigma, pose->pos_sigma, sizeof(pkt.pos_sigma));
+        memcpy(pkt.att_sigma, pose->att_sigma, sizeof(pkt.att_sigma));
+        // no reader on a socket yet isn't an error here, every output counts its own failures
+        // and the status only goes into the log
+        ec = transmit_pose(st->outputs, &pkt, st->settings->compact_pose, &pose->times);
+
+        if (st->first_pose == 0) {
+            st->first_pose = pose->times.transmit;
+            printf("First pose %.1f ms after start\n", (st->first_pose - st->started) / 1000.0);
+        }
+
+        PoseSlot *entry = (PoseSlot *)stage_claim(st, &st->logs);
+        if (entry != NULL) {
+            entry->seq = pose->seq;
+            entry->times = pose->times;
+            entry->nids = pose->nids;
+            memcpy(entry->ids, pose->ids, pose->nids * sizeof(int));
+            entry->p = pose->p;
+            entry->q = pose->q;
+            entry->time = pose->time;
+            entry->predicted = pose->predicted;
+            entry->status = ec;
+
+            ring_publish(&st->logs);
+        }
+
+        ring_release(in);
+
+        stage_allocs(st, STAGE_TRANSMIT, &nframes, &base);
+    }
+
+    stage_exit(st, STAGE_TRANSMIT);
+    return NULL;
+}
+
+// writes the CSV log off the critical path
+static void *log_stage(void *arg) {
+    Stages *st = (Stages *)arg;
+    PoseSlot *entry;
+    struct timeval tstart, tstop;
+    uint64_t nframes = 0, base = 0;
+    int ec;
+
+    gettimeofday(&tstart, NULL);
+
+    while ((entry = (PoseSlot *)stage_next(st, &st->logs, STAGE_TRANSMIT)) != NULL) {
+        ec = log_message(st->logger, &entry->p, &entry->q, entry->time, entry->predicted, entry->status, entry->ids, entry->nids, &entry->times, &tstart, &tstop);
+        if (ec) {
+            printf("Logging returned error code: %d\n", ec);
+        }
+
+        ring_release(&st->logs);
+
+        stage_allocs(st, STAGE_LOG, &nframes, &base);
+    }
+
+    stage_exit(st, STAGE_LOG);
+    return NULL;
+}
+
+int stages_start(Stages *st) {
+    Settings *settings = st->settings;
+    void *(*entry[NSTAGES])(void *) = { capture_stage, NULL, transform_stage, filter_stage, transmit_stage, log_stage };
+    if (!settings->kalman_filter) entry[STAGE_FILTER] = NULL;
+
+    // the frame rings always block, the camera slot and the replay already drop stale frames
+    // the detection rings block too, so every dealt frame comes back in order
+    for (int i = 0; i < st->nworkers; i++) {
+        DetectWorker *w = &st->workers[i];
+        w->st = st;
+        w->index = i;
+        roi_tracker_init(&w->tracker, settings);
+        if (settings->adaptive_tuning) tuner_init(&w->tuner, w->td, settings);
+        pose_tracker_init(&w->poses, settings);
+
+        if (ring_init(&w->frames, FRAME_QUEUE_DEPTH, sizeof(Frame), QUEUE_BLOCK) ||
+                ring_init(&w->detections, settings->queue_depth, sizeof(DetectSlot), QUEUE_BLOCK)) {
+            return 1;
+        }
+
+        if (alloc_detect_poses(&w->detections)) {
+            printf("Unable to allocate the pose matrices for detector %d\n", i);
+            return 2;
+        }
+    }
+
+    if (ring_init(&st->poses, settings->queue_depth, sizeof(PoseSlot), settings->queue_policy) ||
+            ring_init(&st->logs, settings->queue_depth, sizeof(PoseSlot), settings->queue_policy)) {
+        return 1;
+    }
+
+    if (settings->kalman_filter) {
+        pose_filter_init(&st->filter, settings);
+        st->predicted = 0;
+
+        // the filter sends several poses per frame, so its ring holds queue_depth frames' worth of them
+        uint32_t per_frame = settings->framerate > 0 ? settings->kf_rate / settings->framerate + 1 : 1;
+        uint32_t depth = settings->queue_depth * per_frame;
+        if (ring_init(&st->estimates, depth, sizeof(PoseSlot), settings->queue_policy)) {
+            return 1;
+        }
+    }
+
+    st->running = 1;
+    st->first_pose = 0;
+    st->gated = 0;
+    st->gate_resets = 0;
+    memset(st->allocs, 0, sizeof(st->allocs));
+    memset(st->alloc_frames, 0, sizeof(st->alloc_frames));
+    st->detect_running = st->nworkers;
+    memset(st->done, 0, sizeof(st->done));
+
+    for (int i = 0; i < st->nworkers; i++) {
+        if (pthread_create(&st->workers[i].thread, NULL, detect_stage, &st->workers[i]) != 0) {
+            perror("Detector thread creation failed");
+            return 3;
+        }
+    }
+
+    for (int i = 0; i < NSTAGES; i++) {
+        if (entry[i] == NULL) continue;
+
+        if (pthread_create(&st->threads[i], NULL, entry[i], st) != 0) {
+            perror("Stage thread creation failed");
+            return 3;
+        }
+    }
+
+    return 0;
+}
+
+int stages_finished(Stages *st) {
+    return __atomic_load_n(&st->done[STAGE_LOG], __ATOMIC_ACQUIRE);
+}
+
+// steady state allocations per frame of every stage
+// capture and detect call into GStreamer and apriltag, which allocate per frame themselves
+// the stages after them only use preallocated slots, so any allocation there is a regression
+static void stages_report_allocs(Stages *st) {
+    const char *names[NSTAGES] = { "capture", "detect", "transform", "filter", "transmit", "log" };
+
+    printf("Allocations per frame after %d frames of warm up:", ALLOC_WARMUP_FRAMES);
+    for (int i = 0; i < NSTAGES; i++) {
+        if (st->alloc_frames[i] == 0) printf(" %s -", names[i]);
+        else printf(" %s %.2f", names[i], (double)st->allocs[i] / st->alloc_frames[i]);
+    }
+    printf("\n");
+
+    for (int i = STAGE_TRANSFORM; i < NSTAGES; i++) {
+        if (st->allocs[i] > 0) {
+            printf("Warning: the %s stage allocated %llu times in steady state\n", names[i], (unsigned long long)st->allocs[i]);
+        }
+    }
+}
+
+int stages_steady_allocs(Stages *st) {
+    if (!alloc_count_enabled()) {
+        printf("Allocations aren't counted in this build, configure with ALLOC_ACCOUNTING\n");
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = STAGE_TRANSFORM; i < NSTAGES; i++) {
+        if (i == STAGE_FILTER && !st->settings->kalman_filter) continue;
+        if (st->allocs[i] > 0 || st->alloc_frames[i] == 0) failed++;
+    }
+
+    return failed;
+}
+
+int stages_stop(Stages *st) {
+    __atomic_store_n(&st->running, 0, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < NSTAGES; i++) {
+        if (i == STAGE_DETECT || (i == STAGE_FILTER && !st->settings->kalman_filter)) continue;
+        pthread_join(st->threads[i], NULL);
+    }
+
+    for (int i = 0; i < st->nworkers; i++) {
+        DetectWorker *w = &st->workers[i];
+        pthread_join(w->thread, NULL);
+
+        // frames still queued hold camera or replay buffers
+        Frame *frame;
+        while ((frame = (Frame *)ring_peek(&w->frames, 0)) != NULL) {
+            gstream_release_frame(frame);
+            ring_release(&w->frames);
+        }
+
+        free_detect_poses(&w->detections);
+        ring_destroy(&w->frames);
+        ring_destroy(&w->detections);
+
+        if (st->settings->roi_tracking) {
+            printf("Detector %d searches: regions %llu, full frame %llu\n", i,
+                (unsigned long long)w->tracker.roi_searches, (unsigned long long)w->tracker.full_searches);
+        }
+
+        if (st->settings->warm_pose) {
+            printf("Detector %d pose solves: warm %llu, cold %llu, joint rejected %llu\n", i,
+                (unsigned long long)w->poses.warm, (unsigned long long)w->poses.cold, (unsigned long long)w->poses.rejected);
+        }
+
+        if (st->settings->adaptive_tuning) {
+            printf("Detector %d tuning: %llu decimation changes, ended at %.1f, average %.0f us\n", i,
+                (unsigned long long)w->tuner.changes, w->td->quad_decimate, w->tuner.avg);
+        }
+    }
+
+    printf("Queue drops: poses %llu, logs %llu\n",
+        (unsigned long long)st->poses.dropped, (unsigned long long)st->logs.dropped);
+
+    if (st->uart_link != NULL && st->settings->attitude_gate_deg > 0) {
+        printf("Attitude gate: %llu poses dropped, reference reset %llu times\n",
+            (unsigned long long)st->gated, (unsigned long long)st->gate_resets);
+    }
+
+    if (st->settings->kalman_filter) {
+        printf("Filter: %llu measurements, %llu restarts, %llu predicted poses, %llu dropped\n",
+            (unsigned long long)st->filter.updates, (unsigned long long)st->filter.resets,
+            (unsigned long long)st->predicted, (unsigned long long)st->estimates.dropped);
+        ring_destroy(&st->estimates);
+    }
+
+    ring_destroy(&st->poses);
+    ring_destroy(&st->logs);
+
+    if (alloc_count_enabled()) stages_report_allocs(st);
+
+    return 0;
+}
@@ -0,0 +1,339 @@
+#include <tag_map.h>
+
+static int tag_map_alloc(TagMap *map, int size) {
+    memset(map, 0, sizeof(TagMap));
+
+    if (size < 1 || size > TAG_MAP_MAX_ID + 1) {
+        printf("Tag map: ids must be between 0 and %d\n", TAG_MAP_MAX_ID);
+        return 1;
+    }
+
+    map->tags = (TagPose *)calloc(size, sizeof(TagPose));
+    if (map->tags == NULL) {
+        perror("Tag map: allocation failed");
+        return 2;
+    }
+    map->size = size;
+
+    return 0;
+}
+
+static void tag_map_set(TagMap *map, int id, const Quat *q, const Vec3 *t) {
+    TagPose *tag = &map->tags[id];
+
+    if (!tag->valid) map->ntags++;
+    else printf("Tag map: id %d is listed twice, the last one is used\n", id);
+
+    Quat qn = quat_normalize(q);
+    tag->R = mat3_from_quat(&qn);
+    tag->t = *t;
+    tag->valid = 1;
+}
+
+int tag_map_from_grid(TagMap *map, Settings *settings) {
+    int nx = settings->grid_units_x, ny = settings->grid_units_y;
+
+    if (nx < 1 || ny < 1) {
+        printf("Tag map: the grid needs at least one tag in each direction\n");
+        return 1;
+    }
+    if (tag_map_alloc(map, nx * ny)) return 2;
+
+    // the center tag ends up at the origin, the grid is elevation below it (positive down)
+    double cx = settings->grid_unit_length * (settings->center_id % nx);
+    double cy = settings->grid_unit_width * (settings->center_id / nx);
+    Quat identity = { 0, 0, 0, 1 };
+
+    for (int id = 0; id < nx * ny; id++) {
+        // row by row, nx tags per row
+        Vec3 t = { {
+            settings->grid_unit_length * (id % nx) - cx,
+            settings->grid_unit_width * (id / nx) - cy,
+            -settings->grid_elevation
+        } };
+        tag_map_set(map, id, &identity, &t);
+    }
+
+    return 0;
+}
+
+// reads n numbers from a JSON array
+static int json_doubles(json_object *arr, double *out, int n) {
+    if (arr == NULL || !json_object_is_type(arr, json_type_array) || (int)json_object_array_length(arr) != n) return 1;
+
+    for (int i = 0; i < n; i++) {
+        json_object *v = json_object_array_get_idx(arr, i);
+        if (!json_object_is_type(v, json_type_double) && !json_object_is_type(v, json_type_int)) return 1;
+        out[i] = json_object_get_double(v);
+    }
+
+    return 0;
+}
+
+// roll about x, then pitch about y, then yaw about z, all in degrees
+static Quat quat_from_rpy(const double rpy[3]) {
+    Quat q = { 0, 0, 0, 1 };
+
+    for (int i = 0; i < 3; i++) {
+        Vec3 r = { { 0, 0, 0 } };
+        r.v[i] = rpy[i] * M_PI / 180.0;
+        Quat step = quat_exp(&r);
+        q = quat_mul(&step, &q);
+    }
+
+    return q;
+}
+
+static int tag_map_load_json(TagMap *map, const char *path) {
+    json_object *root = json_object_from_file(path);
+    json_object *tags, *tmp;
+
+    if (root == NULL) {
+        printf("Tag map: couldn't read %s\n", path);
+        return 1;
+    }
+
+    if (json_object_object_get_ex(root, "tags", &tags) == 0 || !json_object_is_type(tags, json_type_array)) {
+        printf("Tag map: %s has no tags array\n", path);
+        json_object_put(root);
+        return 2;
+    }
+
+    int n = json_object_array_length(tags);
+
+    // ids are read twice, once for the size of the array and once to fill it
+    int max_id = -1;
+    for (int i = 0; i < n; i++) {
+        json_object *tag = json_object_array_get_idx(tags, i);
+        if (json_object_object_get_ex(tag, "id", &tmp) == 0 || !json_object_is_type(tmp, json_type_int)) {
+            printf("Tag map: entry %d has no integer id\n", i);
+            json_object_put(root);
+            return 3;
+        }
+
+        int id = json_object_get_int(tmp);
+        if (id < 0 || id > TAG_MAP_MAX_ID) {
+            printf("Tag map: id %d of entry %d is out of range\n", id, i);
+            json_object_put(root);
+            return 3;
+        }
+        if (id > max_id) max_id = id;
+    }
+
+    if (tag_map_alloc(map, max_id + 1)) {
+        json_object_put(root);
+        return 4;
+    }
+
+    for (int i = 0; i < n; i++) {
+        json_object *tag = json_object_array_get_idx(tags, i);
+        double position[3], rpy[3] = { 0, 0, 0 };
+
+        json_object_object_get_ex(tag, "id", &tmp);
+        int id = json_object_get_int(tmp);
+
+        if (json_object_object_get_ex(tag, "position", &tmp) == 0 || json_doubles(tmp, position, 3)) {
+            printf("Tag map: tag %d needs a position of 3 numbers\n", id);
+            tag_map_free(map);
+            json_object_put(root);
+            return 5;
+        }
+
+        if (json_object_object_get_ex(tag, "rotation", &tmp) && json_doubles(tmp, rpy, 3)) {
+            printf("Tag map: the rotation of tag %d should be 3 numbers\n", id);
+            tag_map_free(map);
+            json_object_put(root);
+            return 5;
+        }
+
+        Quat q = quat_from_rpy(rpy);
+        Vec3 t = vec3_from_array(position);
+        tag_map_set(map, id, &q, &t);
+    }
+
+    json_object_put(root);
+    return 0;
+}
+
+// little endian whatever the host is
+static uint8_t *put_le(uint8_t *p, uint64_t v, int n) {
+    for (int i = 0; i < n; i++) p[i] = (uint8_t)(v >> (8 * i));
+    return p + n;
+}
+
+static const uint8_t *get_le(const uint8_t *p, uint64_t *v, int n) {
+    *v = 0;
+    for (int i = 0; i < n; i++) *v |= (uint64_t)p[i] << (8 * i);
+    return p + n;
+}
+
+static void record_encode(const TagMapRecord *record, uint8_t *buf) {
+    uint8_t *p = put_le(buf, record->id, 4);
+
+    for (int i = 0; i < 4; i++) {
+        uint32_t u;
+        memcpy(&u, &record->quat[i], sizeof(u));
+        p = put_le(p, u, 4);
+    }
+    for (int i = 0; i < 3; i++) {
+        uint64_t u;
+        memcpy(&u, &record->position[i], sizeof(u));
+        p = put_le(p, u, 8);
+    }
+}
+
+static void record_decode(const uint8_t *buf, TagMapRecord *record) {
+    uint64_t v;
+    const uint8_t *p = get_le(buf, &v, 4);
+    record->id = (uint32_t)v;
+
+    for (int i = 0; i < 4; i++) {
+        p = get_le(p, &v, 4);
+        uint32_t u = (uint32_t)v;
+        memcpy(&record->quat[i], &u, sizeof(u));
+    }
+    for (int i = 0; i < 3; i++) {
+        p = get_le(p, &v, 8);
+        memcpy(&record->position[i], &v, sizeof(v));
+    }
+}
+
+static int tag_map_load_binary(TagMap *map, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Tag map: couldn't open the file");
+        return 1;
+    }
+
+    uint8_t header[TAG_MAP_HEADER_SIZE];
+    uint64_t v;
+    if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, TAG_MAP_MAGIC, 8) != 0) {
+        printf("Tag map: %s isn't a binary tag map\n", path);
+        fclose(file);
+        return 2;
+    }
+    get_le(header + 8, &v, 4);
+    uint32_t n = (uint32_t)v;
+
+    // the count comes from the file, so it can't ask for more records than the file holds
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, TAG_MAP_HEADER_SIZE, SEEK_SET);
+    if (size < TAG_MAP_HEADER_SIZE || n > (uint64_t)(size - TAG_MAP_HEADER_SIZE) / TAG_MAP_RECORD_SIZE) {
+        printf("Tag map: %s is truncated\n", path);
+        fclose(file);
+        return 3;
+    }
+
+    TagMapRecord *records = (TagMapRecord *)malloc((n > 0 ? n : 1) * sizeof(TagMapRecord));
+    if (records == NULL) {
+        perror("Tag map: allocation failed");
+        fclose(file);
+        return 3;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t buf[TAG_MAP_RECORD_SIZE];
+        if (fread(buf, sizeof(buf), 1, file) != 1) {
+            printf("Tag map: %s is truncated\n", path);
+            free(records);
+            fclose(file);
+            return 3;
+        }
+        record_decode(buf, &records[i]);
+    }
+    fclose(file);
+
+    int max_id = -1;
+    for (uint32_t i = 0; i < n; i++) {
+        if (records[i].id > TAG_MAP_MAX_ID) {
+            printf("Tag map: id %u is out of range\n", records[i].id);
+            free(records);
+            return 4;
+        }
+        if ((int)records[i].id > max_id) max_id = records[i].id;
+    }
+
+    if (tag_map_alloc(map, max_id + 1)) {
+        free(records);
+        return 5;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        Quat q = { records[i].quat[0], records[i].quat[1], records[i].quat[2], records[i].quat[3] };
+        Vec3 t = vec3_from_array(records[i].position);
+        tag_map_set(map, records[i].id, &q, &t);
+    }
+
+    free(records);
+    return 0;
+}
+
+int tag_map_load(TagMap *map, const char *path) {
+    size_t len = strlen(path);
+
+    if (len > 5 && strcmp(path + len - 5, ".json") == 0) return tag_map_load_json(map, path);
+    return tag_map_load_binary(map, path);
+}
+
+int tag_map_save(TagMap *map, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror("Tag map: couldn't create the file");
+        return 1;
+    }
+
+    uint32_t n = map->ntags;
+    uint8_t header[TAG_MAP_HEADER_SIZE];
+    memcpy(header, TAG_MAP_MAGIC, 8);
+    put_le(header + 8, n, 4);
+    size_t written = fwrite(header, sizeof(header), 1, file);
+
+    for (int id = 0; id < map->size; id++) {
+        TagPose *tag = &map->tags[id];
+        if (!tag->valid) continue;
+
+        TagMapRecord record;
+        memset(&record, 0, sizeof(record));
+
+        Quat q = quat_from_mat3(&tag->R);
+        record.id = id;
+        record.quat[0] = q.x;
+        record.quat[1] = q.y;
+        record.quat[2] = q.z;
+        record.quat[3] = q.w;
+        memcpy(record.position, tag->t.v, sizeof(record.position));
+
+        uint8_t buf[TAG_MAP_RECORD_SIZE];
+        record_encode(&record, buf);
+        written += fwrite(buf, sizeof(buf), 1, file);
+    }
+
+    if (fclose(file) != 0 || written != 1 + n) {
+        perror("Tag map: write failed");
+        return 2;
+    }
+
+    return 0;
+}
+
+int tag_map_init(TagMap *map, Settings *settings) {
+    int ec;
+
+    if (settings->tag_map_path[0] != '\0') ec = tag_map_load(map, settings->tag_map_path);
+    else ec = tag_map_from_grid(map, settings);
+    if (ec) return ec;
+
+    printf("Tag map: %d tags, ids up to %d\n", map->ntags, map->size - 1);
+
+    if (settings->tag_map_save_path[0] != '\0' && tag_map_save(map, settings->tag_map_save_path) == 0) {
+        printf("Tag map saved to %s\n", settings->tag_map_save_path);
+    }
+
+    return 0;
+}
+
+void tag_map_free(TagMap *map) {
+    free(map->tags);
+    memset(map, 0, sizeof(TagMap));
+}
@@ -4,7 +4,7 @@ int compare_integers(const void *a, const void *b) {
     return (*(int *)a - *(int *)b);
 }
 
-int init_transmit_pose(UARTInfo *uart_info, Settings *settings, CoordDefs *cd) {
+int init_transmit_pose(UARTInfo *uart_info, Settings *settings) {
     // Open UART device
     if (uart_open(uart_info, settings->uart_path) != 0) {
         return -1;
@@ -16,107 +16,90 @@ int init_transmit_pose(UARTInfo *uart_info, Settings *settings, CoordDefs *cd) {
         return -2;
     }
 
-    (*cd).center_x = - settings->grid_unit_length * (float)(settings->center_id % settings->grid_units_x);
-    (*cd).center_y = - settings->grid_unit_width * (float)(settings->center_id / settings->grid_units_x);
-    (*cd).center_z = settings->grid_elevation;
-    (*cd).ulength_x = settings->grid_unit_length;
-    (*cd).uwidth_y = settings->grid_unit_width;
-    (*cd).nx = settings->grid_units_x;
-    (*cd).ny = settings->grid_units_y;
-
-    printf("Coordinate Definitions: cx %.3f, cy %.3f, cz %.3f\n", cd->center_x, cd->center_y, cd->center_z);
-
     return 0;
 }
 
-int pose_transform(matd_t *p, matd_t *q, apriltag_pose_t *poses, CoordDefs *cd, int *ids, uint8_t nids) {
+int pose_transform(Vec3 *p, Quat *q, apriltag_pose_t *poses, TagMap *map, int *ids, uint8_t nids, StageTimes *times) {
     if (p == NULL || q == NULL || poses == NULL) {
         printf("pose_transform: NULL pointer input\n");
         return -1;
     }
 
-    matd_t *tfp = matd_create(3, 1);
-    matd_t *tfR = matd_create(3, 3);
-
-    tfR = matd_transpose(poses[0].R);
-    tfp = matd_multiply(tfR, poses[0].t);
-
-    // Extract translation vector
-    float px = tfp->data[0];
-    float py = tfp->data[1];
-    float pz = tfp->data[2];
-
-    MATD_EL(p, 0, 0) = cd->center_x + cd->ulength_x * (float)(ids[0] % cd->nx) + px;
-    MATD_EL(p, 1, 0) = cd->center_y + cd->uwidth_y * (float)(ids[0] / cd->ny) + py;
-    MATD_EL(p, 2, 0) = pz - cd->center_z;
-
-    // Convert rotation matrix to quaternion
-    float R[3][3];
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            R[i][j] = matd_get(tfR, i, j);
-        }
+    // one array access, however many tags the map has
+    const TagPose *tag = tag_map_get(map, ids[0]);
+    if (tag == NULL) {
+        printf("pose_transform: tag %d isn't in the map\n", ids[0]);
+        return -2;
     }
 
-    // Calculate quaternion components
-    float trace = R[0][0] + R[1][1] + R[2][2];
-    float qw, qx, qy, qz;
+    // copied once out of the matd, everything after this is on the stack
+    Mat3 R = mat3_from_array(poses[0].R->data);
+    Vec3 t = vec3_from_array(poses[0].t->data);
 
-    if (trace > 0) {
-        float S = sqrt(trace + 1.0) * 2; // S=4*qw
+    Mat3 tfR = mat3_transpose(&R);
+    Vec3 tfp = mat3_mul_vec3(&tfR, &t);
 
-        if (abs(S) < SMALL_NUM) S = SMALL_NUM; // prevent division by zero
+    // into the map through the tag's own pose there, the camera sits at -R_c^T t_c in the tag's frame
+    Vec3 mp = mat3_mul_vec3(&tag->R, &tfp);
+    *p = vec3_sub(&tag->t, &mp);
 
-        qw = 0.25 * S;
-        qx = (R[2][1] - R[1][2]) / S;
-        qy = (R[0][2] - R[2][0]) / S;
-        qz = (R[1][0] - R[0][1]) / S;
-    } else if ((R[0][0] > R[1][1]) && (R[0][0] > R[2][2])) {
-        float S = sqrt(1.0 + R[0][0] - R[1][1] - R[2][2]) * 2; // S=4*qx
+    Mat3 att = mat3_mul(&tag->R, &tfR);
+    *q = quat_from_mat3(&att);
 
-        if (abs(S) < SMALL_NUM) S = SMALL_NUM;
+    times->transform = monotonic_us();
 
-        qw = (R[2][1] - R[1][2]) / S;
-        qx = 0.25 * S;
-        qy = (R[0][1] + R[1][0]) / S;
-        qz = (R[0][2] + R[2][0]) / S;
-    } else if (R[1][1] > R[2][2]) {
-        float S = sqrt(1.0 + R[1][1] - R[0][0] - R[2][2]) * 2; // S=4*qy
+    return 0;
+}
 
-        if (abs(S) < SMALL_NUM) S = SMALL_NUM;
+void pose_uncertainty(Settings *settings, apriltag_pose_t *pose, Quat *q, double err, uint8_t ntags,
+        float pos_sigma[3], float att_sigma[3]) {
+    double range = sqrt(pose->t->data[0] * pose->t->data[0] + pose->t->data[1] * pose->t->data[1] + pose->t->data[2] * pose->t->data[2]);
+    double n = ntags > 0 ? ntags : 1;
 
-        qw = (R[0][2] - R[2][0]) / S;
-        qx = (R[0][1] + R[1][0]) / S;
-        qy = 0.25 * S;
-        qz = (R[1][2] + R[2][1]) / S;
-    } else {
-        float S = sqrt(1.0 + R[2][2] - R[0][0] - R[1][1]) * 2; // S=4*qz
+    // corner noise never really goes away, a perfect fit only means the corners agree with each other
+    if (err < POSE_MIN_REPROJ_ERROR) err = POSE_MIN_REPROJ_ERROR;
 
-        if (abs(S) < SMALL_NUM) S = SMALL_NUM;
+    // a pixel is range / fx across the ray and range^2 / (fx tag_size) along it, the tag's apparent size sets depth
+    // every tag adds four more corners, so the noise averages down with the number of tags
+    double across = err * range / settings->fx / sqrt(n);
+    double along = across * range / settings->tag_size;
+    double angle = err * range / (settings->fx * settings->tag_size) / sqrt(n);
+    double s2[3] = { across * across, across * across, along * along };
 
-        qw = (R[1][0] - R[0][1]) / S;
-        qx = (R[0][2] + R[2][0]) / S;
-        qy = (R[1][2] + R[2][1]) / S;
-        qz = 0.25 * S;
+    // diagonal of R diag(s2) R^T, R takes the camera's axes into the map
+    Mat3 R = mat3_from_quat(q);
+    for (int i = 0; i < 3; i++) {
+        double v = 0;
+        for (int k = 0; k < 3; k++) v += R.m[i * 3 + k] * R.m[i * 3 + k] * s2[k];
+        pos_sigma[i] = (float)sqrt(v);
+        att_sigma[i] = (float)angle;
     }
+}
 
-    MATD_EL(q, 0, 0) = qx;
-    MATD_EL(q, 1, 0) = qy;
-    MATD_EL(q, 2, 0) = qz;
-    MATD_EL(q, 3, 0) = qw;
-
-    return 0;
+void pose_packet_fill(PosePacket *pkt, uint16_t seq, Vec3 *p, Quat *q, int64_t time, uint8_t ntags, uint8_t flags) {
+    pkt->seq = seq;
+    pkt->time = time;
+    for (int i = 0; i < 3; i++) pkt->position[i] = (float)p->v[i];
+    pkt->quat[0] = (float)q->x;
+    pkt->quat[1] = (float)q->y;
+    pkt->quat[2] = (float)q->z;
+    pkt->quat[3] = (float)q->w;
+    pkt->ntags = ntags;
+    pkt->flags = flags;
+    memset(pkt->pos_sigma, 0, sizeof(pkt->pos_sigma));
+    memset(pkt->att_sigma, 0, sizeof(pkt->att_sigma));
 }
 
-int transmit_pose(UARTInfo *uart_info, matd_t *p, matd_t *q) {
-    // Transmit the pose data over UART
-    uint8_t start_bytes = {0, 255};
-    ssize_t bytes_written = uart_write(uart_info, start_bytes, 2);
+int transmit_pose(TransportSet *outputs, PosePacket *pkt, uint8_t compact, StageTimes *times) {
+    // built on the stack, nothing is allocated per pose
+    uint8_t buf[POSE_PACKET_SIZE];
+    size_t size = compact ? compact_pose_encode(pkt, buf) : pose_packet_encode(pkt, buf);
 
-    bytes_written = uart_write(uart_info, (uint8_t *)p->data, sizeof(float) * 3);
-    if (bytes_written == -1 || bytes_written != sizeof(float) * 3) {
-        return -1;
-    }
+    // none of them wait, the UART only copies under the writer's lock and spends the wire time on its thread
+    int ec = transports_send(outputs, buf, size);
 
-    return 0;
+    // stamped either way, the pose left this stage and the log still needs the time
+    times->transmit = monotonic_us();
+
+    return ec;
 }
@@ -0,0 +1,194 @@
+#include <transport.h>
+
+static int uart_transport_send(Transport *t, const uint8_t *data, size_t size) {
+    return uart_tx_send(t->tx, data, size);
+}
+
+static void uart_transport_close(Transport *t) {
+    // the writer is stopped by main, the UART link shares it
+}
+
+// one datagram, never waits for the socket
+static int socket_transport_send(Transport *t, const uint8_t *data, size_t size) {
+    ssize_t n = sendto(t->fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&t->addr, t->addr_len);
+    if (n == (ssize_t)size) {
+        t->last_errno = 0;
+        return 0;
+    }
+
+    if (n >= 0 || errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+
+    // no reader on the other end is normal, the first error of a run is printed and the rest counted
+    if (errno != t->last_errno) {
+        fprintf(stderr, "%s transport: send failed: %s\n", t->name, strerror(errno));
+        t->last_errno = errno;
+    }
+    return -1;
+}
+
+static void socket_transport_close(Transport *t) {
+    close(t->fd);
+}
+
+static int shm_transport_send(Transport *t, const uint8_t *data, size_t size) {
+    pose_shm_write(&t->shm, data, size);
+    return 0;
+}
+
+static void shm_transport_close(Transport *t) {
+    pose_shm_close(&t->shm);
+}
+
+int transport_uart_open(Transport *t, UARTTx *tx) {
+    memset(t, 0, sizeof(Transport));
+    t->name = "UART";
+    t->send = uart_transport_send;
+    t->close = uart_transport_close;
+    t->tx = tx;
+    return 0;
+}
+
+int transport_udp_open(Transport *t, const char *host, int port) {
+    struct addrinfo hints, *res;
+    char service[8];
+
+    memset(t, 0, sizeof(Transport));
+    t->name = "UDP";
+    t->send = socket_transport_send;
+    t->close = socket_transport_close;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    snprintf(service, sizeof(service), "%d", port);
+
+    // resolved once here, nothing on the send path looks anything up
+    int ec = getaddrinfo(host, service, &hints, &res);
+    if (ec != 0) {
+        fprintf(stderr, "UDP transport: can't resolve %s: %s\n", host, gai_strerror(ec));
+        return -1;
+    }
+
+    t->fd = socket(res->ai_family, SOCK_DGRAM, 0);
+    if (t->fd < 0) {
+        perror("UDP transport: socket failed");
+        freeaddrinfo(res);
+        return -2;
+    }
+
+    memcpy(&t->addr, res->ai_addr, res->ai_addrlen);
+    t->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+int transport_unix_open(Transport *t, const char *path) {
+    struct sockaddr_un *addr = (struct sockaddr_un *)&t->addr;
+
+    memset(t, 0, sizeof(Transport));
+    t->name = "Unix socket";
+    t->send = socket_transport_send;
+    t->close = socket_transport_close;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Unix socket transport: path %s is too long\n", path);
+        return -1;
+    }
+
+    t->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (t->fd < 0) {
+        perror("Unix socket transport: socket failed");
+        return -2;
+    }
+
+    // not connected, so a reader that binds the path after we start, or restarts, still gets packets
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    t->addr_len = sizeof(struct sockaddr_un);
+
+    return 0;
+}
+
+int transport_shm_open(Transport *t, const char *name, uint32_t nslots) {
+    memset(t, 0, sizeof(Transport));
+    t->name = "Shared memory";
+    t->send = shm_transport_send;
+    t->close = shm_transport_close;
+
+    if (pose_shm_create(&t->shm, name, nslots)) return -1;
+
+    return 0;
+}
+
+int transports_open(TransportSet *ts, Settings *settings, UARTTx *uart_tx) {
+    int ec = 0;
+
+    memset(ts, 0, sizeof(TransportSet));
+
+    if (settings->output_uart && ec == 0) {
+        ec = transport_uart_open(&ts->transports[ts->n], uart_tx);
+        if (ec == 0) ts->n++;
+    }
+    if (settings->output_udp && ec == 0) {
+        ec = transport_udp_open(&ts->transports[ts->n], settings->udp_host, settings->udp_port);
+        if (ec == 0) ts->n++;
+    }
+    if (settings->output_unix && ec == 0) {
+        ec = transport_unix_open(&ts->transports[ts->n], settings->unix_socket_path);
+        if (ec == 0) ts->n++;
+    }
+    if (settings->output_shm && ec == 0) {
+        ec = transport_shm_open(&ts->transports[ts->n], settings->shm_name, settings->shm_slots);
+        if (ec == 0) ts->n++;
+    }
+
+    if (ec != 0) {
+        transports_close(ts);
+        return -1;
+    }
+    if (ts->n == 0) {
+        fprintf(stderr, "No pose output enabled in the settings\n");
+        return -2;
+    }
+
+    return 0;
+}
+
+int transports_send(TransportSet *ts, const uint8_t *data, size_t size) {
+    int dropped = 0, took = 0;
+
+    for (uint8_t i = 0; i < ts->n; i++) {
+        Transport *t = &ts->transports[i];
+        int ec = t->send(t, data, size);
+
+        if (ec < 0) {
+            t->failed++;
+            continue;
+        }
+
+        took++;
+        if (ec > 0) {
+            t->dropped++;
+            dropped++;
+        }
+        else {
+            t->sent++;
+        }
+    }
+
+    return took > 0 ? dropped : -1;
+}
+
+void transports_close(TransportSet *ts) {
+    for (uint8_t i = 0; i < ts->n; i++) {
+        Transport *t = &ts->transports[i];
+
+        printf("%s output: sent %llu, dropped %llu, failed %llu\n", t->name,
+            (unsigned long long)t->sent, (unsigned long long)t->dropped, (unsigned long long)t->failed);
+        t->close(t);
+    }
+
+    ts->n = 0;
+}
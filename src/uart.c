@@ -40,8 +40,9 @@ int uart_configure(UARTInfo *info, int baud_rate, int parity, int stop_bits, int
 
     cfmakeraw(&options); // Set raw mode
 
-    // Set baud rate
+    // Set baud rate, anything without a B constant is set through termios2 once the rest is in place
     speed_t speed;
+    int custom = 0;
     switch (baud_rate) {
         case 0: speed = B0; break;
         case 50: speed = B50; break;
@@ -64,8 +65,12 @@ int uart_configure(UARTInfo *info, int baud_rate, int parity, int stop_bits, int
         case 230400: speed = B230400; break;
         case 460800: speed = B460800; break;
         default:
-            fprintf(stderr, "UART: Unsupported baud rate %d\n", baud_rate);
-            return -2;
+            if (baud_rate <= 0) {
+                fprintf(stderr, "UART: Unsupported baud rate %d\n", baud_rate);
+                return -2;
+            }
+            speed = B38400;
+            custom = 1;
     }
 
     // Set input and output baud rates
@@ -117,6 +122,20 @@ int uart_configure(UARTInfo *info, int baud_rate, int parity, int stop_bits, int
         return -3;
     }
 
+    if (custom && uart_set_custom_baud(info->fd, baud_rate) != 0) {
+        close((*info).fd);
+        (*info).fd = -1;
+        return -4;
+    }
+
+    // the divider may not hit the rate exactly, a few percent off and the other end sees framing errors
+    int actual = uart_get_baud(info->fd);
+    if (actual > 0 && abs(actual - baud_rate) > baud_rate / 50) {
+        fprintf(stderr, "UART: asked for %d baud, the driver runs at %d\n", baud_rate, actual);
+    }
+    (*info).baud = actual > 0 ? actual : baud_rate;
+    (*info).bits_per_char = 1 + data_bits + (parity != 0) + (stop_bits == 1 ? 1 : 2);
+
     // Save the settings in the UARTInfo struct
     (*info).settings = options;
 
@@ -138,7 +157,7 @@ ssize_t uart_write(UARTInfo *info, const uint8_t *data, size_t size) {
         return -1;
     }
 
-    tcdrain(info->fd); // flush the output buffer
+    // no tcdrain, the bytes are in the driver's buffer and waiting for them to leave would only block the caller
 
     return bytes_written;
 }
@@ -178,4 +197,12 @@ ssize_t uart_read(UARTInfo *info, uint8_t *data, size_t size) {
     }
 
     return bytes_read;
-}
\ No newline at end of file
+}
+
+int uart_outq(UARTInfo *info) {
+    int n;
+
+    if (ioctl(info->fd, TIOCOUTQ, &n) == -1) return -1;
+
+    return n;
+}
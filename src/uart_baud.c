@@ -0,0 +1,37 @@
+#include <uart_baud.h>
+
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+
+int uart_set_custom_baud(int fd, int baud) {
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) == -1) {
+        perror("UART: Unable to get termios2 attributes");
+        return -1;
+    }
+
+    // BOTHER takes the rate from c_ispeed and c_ospeed as a plain number
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_cflag &= ~(CBAUD << IBSHIFT);
+    tio.c_cflag |= BOTHER << IBSHIFT;
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+
+    if (ioctl(fd, TCSETS2, &tio) == -1) {
+        perror("UART: Unable to set a custom baud rate");
+        return -2;
+    }
+
+    return 0;
+}
+
+int uart_get_baud(int fd) {
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) == -1) return -1;
+
+    return (int)tio.c_ospeed;
+}
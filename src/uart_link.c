@@ -0,0 +1,182 @@
+#include <uart_link.h>
+
+static int link_running(UARTLink *link) {
+    return __atomic_load_n(&link->running, __ATOMIC_ACQUIRE);
+}
+
+// the writer stamps t1 and sends it ahead of any queued poses, a ping never waits behind them
+static void link_ping(UARTLink *link) {
+    uart_tx_ping(link->tx, link->ping_seq++);
+    link->pings++;
+}
+
+static void link_pong(UARTLink *link, int64_t t4) {
+    PongPacket pong;
+    if (pong_payload_parse(link->parser.payload, link->parser.payload_len, &pong)) return;
+
+    // an answer to a ping from before the last restart or one that arrived after a newer one was sent
+    if ((uint16_t)(link->ping_seq - pong.seq) != 1) {
+        link->stale_pongs++;
+        return;
+    }
+
+    pthread_mutex_lock(&link->lock);
+    clock_sync_add(&link->sync, (int64_t)pong.t1, (int64_t)pong.t2, (int64_t)pong.t3, t4);
+    pthread_mutex_unlock(&link->lock);
+
+    link->pongs++;
+}
+
+static void link_attitude(UARTLink *link) {
+    AttitudePacket att;
+    if (attitude_payload_parse(link->parser.payload, link->parser.payload_len, &att)) return;
+
+    pthread_mutex_lock(&link->lock);
+
+    // can't be placed on our time line before the clocks are synchronized
+    if (link->sync.valid) {
+        AttitudeSample *s = &link->attitudes[link->att_head];
+        s->time = clock_sync_to_local(&link->sync, (int64_t)att.time);
+        Quat q = { att.quat[0], att.quat[1], att.quat[2], att.quat[3] };
+        s->q = quat_normalize(&q);
+
+        link->att_head = (link->att_head + 1) % UART_LINK_ATT_HISTORY;
+        if (link->att_count < UART_LINK_ATT_HISTORY) link->att_count++;
+    }
+
+    pthread_mutex_unlock(&link->lock);
+
+    link->attitudes_received++;
+}
+
+static void *link_thread(void *arg) {
+    UARTLink *link = (UARTLink *)arg;
+    uint8_t buf[256];
+    int64_t next_ping = monotonic_us();
+
+    while (link_running(link)) {
+        int64_t now = monotonic_us();
+        if (now >= next_ping) {
+            link_ping(link);
+            next_ping += link->interval;
+            if (next_ping <= now) next_ping = now + link->interval;
+        }
+
+        int timeout = (int)((next_ping - now) / 1000);
+        if (timeout > UART_LINK_POLL_MS) timeout = UART_LINK_POLL_MS;
+
+        struct pollfd pfd = { .fd = link->uart->fd, .events = POLLIN };
+        int ec = poll(&pfd, 1, timeout);
+        if (ec < 0) {
+            if (errno == EINTR) continue;
+            perror("UART: poll failed");
+            break;
+        }
+        if (ec == 0) continue;
+
+        ssize_t n = uart_read(link->uart, buf, sizeof(buf));
+        if (n < 0) break;
+
+        // the same receive time for every packet in this read, the best there is without driver timestamps
+        int64_t t4 = monotonic_us();
+        for (ssize_t i = 0; i < n; i++) {
+            int type = packet_parser_feed(&link->parser, buf[i]);
+            if (type == PACKET_PONG) link_pong(link, t4);
+            else if (type == PACKET_ATTITUDE) link_attitude(link);
+        }
+    }
+
+    return NULL;
+}
+
+int uart_link_start(UARTLink *link, UARTInfo *uart, UARTTx *tx, int interval_ms) {
+    memset(link, 0, sizeof(UARTLink));
+    link->uart = uart;
+    link->tx = tx;
+    link->interval = (int64_t)(interval_ms > 0 ? interval_ms : 1) * 1000;
+    link->running = 1;
+
+    packet_parser_init(&link->parser);
+    clock_sync_init(&link->sync);
+    pthread_mutex_init(&link->lock, NULL);
+
+    if (pthread_create(&link->thread, NULL, link_thread, link) != 0) {
+        perror("UART: reader thread creation failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+int uart_link_stop(UARTLink *link) {
+    __atomic_store_n(&link->running, 0, __ATOMIC_RELEASE);
+    pthread_join(link->thread, NULL);
+
+    printf("UART link: pings %llu, pongs %llu (%llu stale, %llu slow), attitudes %llu, CRC errors %llu\n",
+        (unsigned long long)link->pings, (unsigned long long)link->pongs, (unsigned long long)link->stale_pongs,
+        (unsigned long long)link->sync.rejected, (unsigned long long)link->attitudes_received,
+        (unsigned long long)link->parser.crc_errors);
+    if (link->sync.valid) {
+        printf("UART link: controller clock offset %.0f us, drift %.1f ppm\n", link->sync.offset, link->sync.drift * 1e6);
+    }
+
+    pthread_mutex_destroy(&link->lock);
+
+    return 0;
+}
+
+int uart_link_remote_time(UARTLink *link, int64_t local, int64_t *remote) {
+    pthread_mutex_lock(&link->lock);
+    int valid = link->sync.valid;
+    if (valid) *remote = clock_sync_to_remote(&link->sync, local);
+    pthread_mutex_unlock(&link->lock);
+
+    return !valid;
+}
+
+// attitude at local time t, interpolated between the two samples around it, caller holds the lock
+static int attitude_at(UARTLink *link, int64_t t, Quat *q) {
+    if (link->att_count == 0) return 1;
+
+    const AttitudeSample *newest = &link->attitudes[(link->att_head + UART_LINK_ATT_HISTORY - 1) % UART_LINK_ATT_HISTORY];
+    if (t >= newest->time) {
+        if (t - newest->time > UART_LINK_ATT_HOLD) return 1;
+        *q = newest->q;
+        return 0;
+    }
+
+    // newest to oldest, frames are looked up shortly after they were taken
+    for (uint32_t i = 1; i < link->att_count; i++) {
+        const AttitudeSample *b = &link->attitudes[(link->att_head + UART_LINK_ATT_HISTORY - i) % UART_LINK_ATT_HISTORY];
+        const AttitudeSample *a = &link->attitudes[(link->att_head + UART_LINK_ATT_HISTORY - i - 1) % UART_LINK_ATT_HISTORY];
+        if (t < a->time) continue;
+
+        double s = b->time > a->time ? (double)(t - a->time) / (b->time - a->time) : 0;
+        Quat ac = quat_conj(&a->q);
+        Quat d = quat_mul(&ac, &b->q);
+        Vec3 r = quat_log(&d);
+        r = vec3_scale(&r, s);
+        Quat step = quat_exp(&r);
+        *q = quat_mul(&a->q, &step);
+        return 0;
+    }
+
+    return 1;
+}
+
+int uart_link_attitude_delta(UARTLink *link, int64_t t0, int64_t t1, double *angle) {
+    Quat q0, q1;
+
+    pthread_mutex_lock(&link->lock);
+    int ec = attitude_at(link, t0, &q0) || attitude_at(link, t1, &q1);
+    pthread_mutex_unlock(&link->lock);
+    if (ec) return 1;
+
+    // the angle of the relative rotation is the same whatever frame either attitude is expressed in
+    Quat c = quat_conj(&q0);
+    Quat d = quat_mul(&c, &q1);
+    Vec3 r = quat_log(&d);
+    *angle = vec3_norm(&r);
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <uart_tx.h>
+
+static int tx_running(UARTTx *tx) {
+    return __atomic_load_n(&tx->running, __ATOMIC_ACQUIRE);
+}
+
+// writes one packet, waiting on poll whenever the driver's buffer is full
+static int tx_write_all(UARTTx *tx, const uint8_t *data, size_t size) {
+    size_t off = 0;
+
+    while (off < size) {
+        struct pollfd pfd = { .fd = tx->uart->fd, .events = POLLOUT };
+        int ec = poll(&pfd, 1, UART_TX_POLL_MS);
+
+        if (ec < 0) {
+            if (errno == EINTR) continue;
+            perror("UART: poll failed");
+            return -1;
+        }
+        if (ec == 0) {
+            if (!tx_running(tx)) return -1;
+            continue;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            fprintf(stderr, "UART: device error while writing\n");
+            return -1;
+        }
+
+        ssize_t written = uart_write(tx->uart, data + off, size - off);
+        if (written < 0) return -1;
+
+        // 0 is EAGAIN, poll again
+        if (written > 0 && (size_t)written < size - off) tx->partial++;
+        off += written;
+    }
+
+    return 0;
+}
+
+// what one byte costs on the wire in us
+static double tx_byte_us(UARTTx *tx) {
+    return tx->uart->bits_per_char * 1e6 / tx->uart->baud;
+}
+
+// the packet just written is at the back of the driver's queue, its last byte goes out once everything ahead of it has
+// TIOCOUTQ counts what is still waiting, so that times the byte cost is how long this packet sits in the queue
+static void tx_account(UARTTx *tx, size_t size) {
+    tx->bytes += size;
+    tx->window_bytes += size;
+
+    int outq = uart_outq(tx->uart);
+    if (outq < 0) return;
+
+    int64_t queued = (int64_t)(outq * tx_byte_us(tx));
+    if (queued > tx->max_queue) tx->max_queue = queued;
+    if (queued > tx->window_max_queue) tx->window_max_queue = queued;
+    tx->queue_sum += queued;
+    tx->queue_samples++;
+}
+
+static void tx_report(UARTTx *tx, int64_t now) {
+    double s = (now - tx->window_start) / 1e6;
+    double capacity = 1e6 / tx_byte_us(tx); // bytes per second
+
+    printf("UART: %.0f B/s of %.0f, %.1f%% of the link, longest in the driver queue %.2f ms\n",
+        tx->window_bytes / s, capacity, 100.0 * tx->window_bytes / s / capacity, tx->window_max_queue / 1000.0);
+
+    tx->window_start = now;
+    tx->window_bytes = 0;
+    tx->window_max_queue = 0;
+}
+
+// t1 is when the ping's first byte leaves, after everything already in the driver's queue
+static size_t tx_ping_encode(UARTTx *tx, uint16_t seq, uint8_t *buf) {
+    int64_t t1 = monotonic_us();
+
+    int outq = uart_outq(tx->uart);
+    if (outq > 0) t1 += (int64_t)(outq * tx_byte_us(tx));
+
+    PingPacket ping = { .seq = seq, .t1 = (uint64_t)t1 };
+    return ping_packet_encode(&ping, buf);
+}
+
+static void *tx_thread(void *arg) {
+    UARTTx *tx = (UARTTx *)arg;
+    uint8_t buf[POSE_PACKET_MAX];
+    size_t size;
+
+    while (1) {
+        pthread_mutex_lock(&tx->lock);
+        while (tx->count == 0 && !tx->ping_pending && tx_running(tx)) pthread_cond_wait(&tx->ready, &tx->lock);
+
+        if (!tx_running(tx)) {
+            pthread_mutex_unlock(&tx->lock);
+            break;
+        }
+
+        if (tx->ping_pending) {
+            uint16_t seq = tx->ping_seq;
+            tx->ping_pending = 0;
+            pthread_mutex_unlock(&tx->lock);
+
+            // stamped after the lock, right before the write, so waiting on it doesn't count toward the round trip
+            size = tx_ping_encode(tx, seq, buf);
+        }
+        else {
+            // copied out so the slot is free again while this one is on the wire
+            size = tx->sizes[tx->head];
+            memcpy(buf, tx->slots[tx->head], size);
+            tx->head = (tx->head + 1) % UART_TX_DEPTH;
+            tx->count--;
+            pthread_mutex_unlock(&tx->lock);
+        }
+
+        if (tx_write_all(tx, buf, size) == 0) {
+            tx->sent++;
+            tx_account(tx, size);
+        }
+        else {
+            tx->failed++;
+        }
+
+        int64_t now = monotonic_us();
+        if (tx->report_us > 0 && now - tx->window_start >= tx->report_us) tx_report(tx, now);
+    }
+
+    return NULL;
+}
+
+int uart_tx_start(UARTTx *tx, UARTInfo *uart, int report_ms) {
+    memset(tx, 0, sizeof(UARTTx));
+    tx->uart = uart;
+    tx->running = 1;
+    tx->report_us = (int64_t)report_ms * 1000;
+    tx->started = monotonic_us();
+    tx->window_start = tx->started;
+
+    pthread_mutex_init(&tx->lock, NULL);
+    pthread_cond_init(&tx->ready, NULL);
+
+    if (pthread_create(&tx->thread, NULL, tx_thread, tx) != 0) {
+        perror("UART: writer thread creation failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+int uart_tx_send(UARTTx *tx, const uint8_t *data, size_t size) {
+    int dropped = 0;
+
+    if (size > POSE_PACKET_MAX) return -1;
+
+    pthread_mutex_lock(&tx->lock);
+
+    // latest wins, the oldest waiting packet makes room
+    if (tx->count == UART_TX_DEPTH) {
+        tx->head = (tx->head + 1) % UART_TX_DEPTH;
+        tx->count--;
+        tx->dropped++;
+        dropped = 1;
+    }
+
+    uint32_t slot = (tx->head + tx->count) % UART_TX_DEPTH;
+    memcpy(tx->slots[slot], data, size);
+    tx->sizes[slot] = size;
+    tx->count++;
+    tx->queued++;
+
+    pthread_cond_signal(&tx->ready);
+    pthread_mutex_unlock(&tx->lock);
+
+    return dropped;
+}
+
+int uart_tx_ping(UARTTx *tx, uint16_t seq) {
+    pthread_mutex_lock(&tx->lock);
+    int replaced = tx->ping_pending;
+    if (replaced) tx->dropped++;
+    tx->ping_pending = 1;
+    tx->ping_seq = seq;
+    tx->queued++;
+
+    pthread_cond_signal(&tx->ready);
+    pthread_mutex_unlock(&tx->lock);
+
+    return replaced;
+}
+
+int uart_tx_stop(UARTTx *tx) {
+    pthread_mutex_lock(&tx->lock);
+    __atomic_store_n(&tx->running, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&tx->ready);
+    pthread_mutex_unlock(&tx->lock);
+
+    pthread_join(tx->thread, NULL);
+
+    printf("UART: queued %llu, sent %llu, dropped %llu, partial writes %llu, failed %llu\n",
+        (unsigned long long)tx->queued, (unsigned long long)tx->sent, (unsigned long long)tx->dropped,
+        (unsigned long long)tx->partial, (unsigned long long)tx->failed);
+
+    double s = (monotonic_us() - tx->started) / 1e6;
+    double capacity = 1e6 / tx_byte_us(tx);
+    if (s > 0) {
+        printf("UART: %d baud, %.0f B/s of %.0f, %.1f%% of the link, driver queue average %.2f ms, longest %.2f ms\n",
+            tx->uart->baud, tx->bytes / s, capacity, 100.0 * tx->bytes / s / capacity,
+            tx->queue_samples > 0 ? tx->queue_sum / tx->queue_samples / 1000.0 : 0, tx->max_queue / 1000.0);
+    }
+
+    pthread_mutex_destroy(&tx->lock);
+    pthread_cond_destroy(&tx->ready);
+
+    return 0;
+}
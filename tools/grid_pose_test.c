@@ -0,0 +1,126 @@
+// checks the joint pose solve on detections projected from a known camera pose over the grid map
+// the first frame is solved cold, the same frame again has to start from the kept pose and count as warm,
+// and the pose kept for the next frame has to be the camera's pose in the map
+//
+// grid_pose_test   exits nonzero on any failure
+
+#include <grid_pose.h>
+#include <tag_map.h>
+
+#include <apriltag/common/homography.h>
+
+#define TEST_TAGS 4
+#define TEST_MAX_ERROR 0.01 // px, the corners are exact so the fit should be too
+#define TEST_MAX_POSE_ERROR 1e-6 // m and rotation matrix entries
+
+// camera pose in the map, X_cam = R X_map + t, looking down at the grid from about 0.8 m above it
+static void camera_pose(Mat3 *R, Vec3 *t) {
+    Vec3 down = { { M_PI, 0, 0 } }, tilt = { { 0.05, -0.08, 0.3 } };
+    Quat qd = quat_exp(&down), qt = quat_exp(&tilt);
+    Quat q = quat_mul(&qt, &qd);
+    *R = mat3_from_quat(&q);
+
+    Vec3 c = { { 0.08, 0.05, 0.0 } }; // camera center, the grid is at -grid_elevation
+    Vec3 rc = mat3_mul_vec3(R, &c);
+    *t = vec3_scale(&rc, -1);
+}
+
+// corners of tag id as apriltag would report them, and the homography it would fit to them
+static void project_tag(const TagPose *tag, const Mat3 *R, const Vec3 *t, apriltag_detection_info_t *info,
+        int id, apriltag_detection_t *det) {
+    // in the order of apriltag's detection corners, as its pose solve takes them
+    double h = info->tagsize / 2, corr[4][4];
+    double corners[4][3] = { { -h, h, 0 }, { h, h, 0 }, { h, -h, 0 }, { -h, -h, 0 } };
+
+    memset(det, 0, sizeof(apriltag_detection_t));
+    det->id = id;
+
+    for (int k = 0; k < 4; k++) {
+        Vec3 c = vec3_from_array(corners[k]);
+        Vec3 X = mat3_mul_vec3(&tag->R, &c);
+        X = vec3_add(&X, &tag->t);
+
+        Vec3 Xc = mat3_mul_vec3(R, &X);
+        Xc = vec3_add(&Xc, t);
+
+        det->p[k][0] = info->fx * Xc.v[0] / Xc.v[2] + info->cx;
+        det->p[k][1] = info->fy * Xc.v[1] / Xc.v[2] + info->cy;
+
+        // the same correspondences apriltag fits its homography to
+        corr[k][0] = (k == 0 || k == 3) ? -1 : 1;
+        corr[k][1] = (k == 0 || k == 1) ? -1 : 1;
+        corr[k][2] = det->p[k][0];
+        corr[k][3] = det->p[k][1];
+        det->c[0] += det->p[k][0] / 4;
+        det->c[1] += det->p[k][1] / 4;
+    }
+
+    det->H = homography_compute2(corr);
+}
+
+int main(void) {
+    Settings settings;
+    memset(&settings, 0, sizeof(Settings));
+    settings.grid_unit_length = 0.15;
+    settings.grid_unit_width = 0.15;
+    settings.grid_units_x = 2;
+    settings.grid_units_y = 2;
+    settings.grid_elevation = 0.79;
+    settings.center_id = 0;
+    settings.warm_max_jump = 0.1;
+
+    TagMap map;
+    if (tag_map_from_grid(&map, &settings)) return 2;
+
+    apriltag_detection_info_t info = { .tagsize = 0.084, .fx = 600, .fy = 600, .cx = 320, .cy = 240 };
+
+    Mat3 R;
+    Vec3 t;
+    camera_pose(&R, &t);
+
+    apriltag_detection_t dets[TEST_TAGS], *detp[TEST_TAGS];
+    apriltag_pose_t poses[TEST_TAGS];
+    for (int id = 0; id < TEST_TAGS; id++) {
+        project_tag(tag_map_get(&map, id), &R, &t, &info, id, &dets[id]);
+        detp[id] = &dets[id];
+        poses[id].R = matd_create(3, 3);
+        poses[id].t = matd_create(3, 1);
+    }
+
+    PoseTracker pt;
+    pose_tracker_init(&pt, &settings);
+
+    int failed = 0;
+    double err0 = grid_pose_estimate(&info, detp, TEST_TAGS, &map, &pt, 0, poses);
+    double err1 = grid_pose_estimate(&info, detp, TEST_TAGS, &map, &pt, 1000, poses);
+
+    printf("First frame: error %.4f px, second frame: error %.4f px, warm %llu, cold %llu\n",
+        err0, err1, (unsigned long long)pt.warm, (unsigned long long)pt.cold);
+
+    if (err0 < 0 || err0 > TEST_MAX_ERROR || err1 < 0 || err1 > TEST_MAX_ERROR) {
+        printf("FAIL the joint solve doesn't fit exact corners\n");
+        failed++;
+    }
+    if (pt.cold != 1 || pt.warm != 1) {
+        printf("FAIL the same frame twice should be one cold and one warm solve\n");
+        failed++;
+    }
+
+    double worst = 0;
+    for (int i = 0; i < 9; i++) worst = fmax(worst, fabs(pt.grid.R[i] - R.m[i]));
+    for (int r = 0; r < 3; r++) worst = fmax(worst, fabs(pt.grid.t[r] - t.v[r]));
+    if (worst > TEST_MAX_POSE_ERROR) {
+        printf("FAIL the kept pose is %g off the camera's pose in the map\n", worst);
+        failed++;
+    }
+
+    for (int id = 0; id < TEST_TAGS; id++) {
+        matd_destroy(dets[id].H);
+        matd_destroy(poses[id].R);
+        matd_destroy(poses[id].t);
+    }
+    tag_map_free(&map);
+
+    printf("%s\n", failed ? "FAILED" : "Passed");
+    return failed != 0;
+}
@@ -0,0 +1,91 @@
+// converts a binary flight log from log_binary into the CSV the text logger writes
+// works on the log of a run that crashed too, everything the tracker wrote before it died is in the file
+//
+// log2csv <log.bin> [out.csv]   writes to stdout without out.csv
+
+#include <logger.h>
+#include <flight_log.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <log.bin> [out.csv]\n", argv[0]);
+        return 1;
+    }
+
+    int in = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (in == -1 || fstat(in, &st) == -1) {
+        perror("Couldn't open the log");
+        return 2;
+    }
+
+    if ((size_t)st.st_size < FLIGHT_LOG_DATA_OFFSET) {
+        fprintf(stderr, "%s is too short to be a flight log\n", argv[1]);
+        return 3;
+    }
+
+    uint8_t *map = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, in, 0);
+    if (map == MAP_FAILED) {
+        perror("Couldn't map the log");
+        return 2;
+    }
+
+    const FlightLogHeader *header = (const FlightLogHeader *)map;
+    const LogRecord *records = (const LogRecord *)(map + FLIGHT_LOG_DATA_OFFSET);
+
+    if (memcmp(header->magic, FLIGHT_LOG_MAGIC, sizeof(header->magic)) != 0 || header->record_size != sizeof(LogRecord)) {
+        fprintf(stderr, "%s isn't a flight log of this version\n", argv[1]);
+        return 3;
+    }
+    if (header->capacity == 0 || FLIGHT_LOG_DATA_OFFSET + header->capacity * sizeof(LogRecord) > (size_t)st.st_size) {
+        fprintf(stderr, "%s is cut short, it should hold %llu records\n", argv[1], (unsigned long long)header->capacity);
+        return 3;
+    }
+
+    int out = STDOUT_FILENO;
+    if (argc >= 3) {
+        out = open(argv[2], O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (out == -1) {
+            perror("Couldn't create the CSV");
+            return 4;
+        }
+    }
+
+    // only the last lap of the ring is still there, oldest first
+    uint64_t head = header->head;
+    uint64_t first = head > header->capacity ? head - header->capacity : 0;
+    uint64_t written = 0, missing = 0;
+
+    log_csv_header(out, header->options);
+
+    for (uint64_t n = first; n < head; n++) {
+        const LogRecord *rec = &records[n % header->capacity];
+
+        // a record the tracker didn't finish before it died
+        if (rec->index != n + 1) {
+            missing++;
+            continue;
+        }
+
+        log_record_csv(out, header->options, rec);
+        written++;
+    }
+
+    fprintf(stderr, "%llu records written", (unsigned long long)written);
+    if (first > 0) fprintf(stderr, ", %llu older ones were overwritten", (unsigned long long)first);
+    if (missing > 0) fprintf(stderr, ", %llu incomplete", (unsigned long long)missing);
+    fprintf(stderr, "\n");
+
+    if (out != STDOUT_FILENO) close(out);
+    munmap(map, st.st_size);
+    close(in);
+
+    return 0;
+}
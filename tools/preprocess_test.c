@@ -0,0 +1,140 @@
+// checks every preprocessing kernel built into this binary against the scalar one, for every factor with and without blur
+// the scalar kernel itself is checked against a direct per pixel version of the same arithmetic
+// sizes cover the vector widths, their tails and single rows and columns, kernels the CPU lacks are skipped
+//
+// preprocess_test   exits nonzero on any mismatch
+
+#include <preprocess.h>
+
+#define TEST_MAX_WIDTH 643
+#define TEST_MAX_HEIGHT 9
+
+static const int widths[] = { 1, 2, 7, 8, 9, 15, 16, 17, 31, 32, 33, 77, TEST_MAX_WIDTH };
+static const int heights[] = { 1, 2, 3, TEST_MAX_HEIGHT };
+static const uint8_t kernels[] = { PRE_SSSE3, PRE_AVX2, PRE_NEON };
+
+static uint8_t gray_ref(const uint8_t *src, int stride, int factor, int x, int y) {
+    uint32_t s = 0, n = factor * factor;
+
+    for (int dy = 0; dy < factor; dy++) {
+        for (int dx = 0; dx < factor; dx++) {
+            const uint8_t *p = src + (size_t)(y * factor + dy) * stride + (x * factor + dx) * 4;
+            s += 15 * p[0] + 75 * p[1] + 38 * p[2];
+        }
+    }
+
+    return (uint8_t)((s + 64 * n) / (128 * n));
+}
+
+// [1 2 1] both ways with the outermost pixel repeated, no intermediate rounding
+static void run_ref(const uint8_t *src, int stride, int factor, int blur, int w, int h, uint8_t *gray, uint8_t *dst) {
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) gray[y * w + x] = gray_ref(src, stride, factor, x, y);
+    }
+
+    if (!blur) {
+        memcpy(dst, gray, (size_t)w * h);
+        return;
+    }
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint32_t s = 0;
+
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int yy = y + dy < 0 ? 0 : (y + dy >= h ? h - 1 : y + dy);
+                    int xx = x + dx < 0 ? 0 : (x + dx >= w ? w - 1 : x + dx);
+                    s += (uint32_t)(2 - (dy != 0)) * (2 - (dx != 0)) * gray[yy * w + xx];
+                }
+            }
+
+            dst[y * w + x] = (uint8_t)((s + 8) >> 4);
+        }
+    }
+}
+
+static int compare(const char *what, uint8_t factor, uint8_t blur, int w, int h, const uint8_t *out, const uint8_t *ref) {
+    for (int i = 0; i < w * h; i++) {
+        if (out[i] != ref[i]) {
+            printf("FAIL %s factor %d blur %d %dx%d: pixel (%d, %d) is %d, expected %d\n",
+                what, factor, blur, w, h, i % w, i / w, out[i], ref[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(void) {
+    int stride = TEST_MAX_WIDTH * PRE_MAX_FACTOR * 4 + 12;
+    size_t src_size = (size_t)stride * TEST_MAX_HEIGHT * PRE_MAX_FACTOR;
+
+    uint8_t *src = (uint8_t *)malloc(src_size);
+    uint8_t *gray = (uint8_t *)malloc(TEST_MAX_WIDTH * TEST_MAX_HEIGHT);
+    uint8_t *ref = (uint8_t *)malloc(TEST_MAX_WIDTH * TEST_MAX_HEIGHT);
+    uint8_t *scalar = (uint8_t *)malloc(TEST_MAX_WIDTH * TEST_MAX_HEIGHT);
+    uint8_t *out = (uint8_t *)malloc(TEST_MAX_WIDTH * TEST_MAX_HEIGHT);
+
+    if (src == NULL || gray == NULL || ref == NULL || scalar == NULL || out == NULL) {
+        perror("Test buffer allocation failed");
+        return 2;
+    }
+
+    // full range noise plus all white and all black rows to hit the rounding limits
+    uint32_t state = 12345;
+    for (size_t i = 0; i < src_size; i++) {
+        state = state * 1103515245 + 12345;
+        src[i] = (uint8_t)(state >> 16);
+    }
+    memset(src, 0xff, stride);
+    memset(src + (size_t)stride * (TEST_MAX_HEIGHT * PRE_MAX_FACTOR - 1), 0, stride);
+
+    int failed = 0, checked = 0;
+    uint8_t tested[sizeof(kernels)] = { 0 };
+
+    for (uint8_t factor = 1; factor <= PRE_MAX_FACTOR; factor++) {
+        for (uint8_t blur = 0; blur <= 1; blur++) {
+            Preprocessor pre;
+            if (preprocess_init(&pre, factor, blur, TEST_MAX_WIDTH) != 0) return 2;
+
+            for (size_t wi = 0; wi < sizeof(widths) / sizeof(widths[0]); wi++) {
+                for (size_t hi = 0; hi < sizeof(heights) / sizeof(heights[0]); hi++) {
+                    int w = widths[wi], h = heights[hi];
+
+                    run_ref(src, stride, factor, blur, w, h, gray, ref);
+
+                    preprocess_set_kernel(&pre, PRE_SCALAR);
+                    preprocess_run(&pre, src, stride, w, h, scalar, w);
+                    failed += compare("scalar", factor, blur, w, h, scalar, ref);
+                    checked++;
+
+                    for (size_t k = 0; k < sizeof(kernels); k++) {
+                        if (preprocess_set_kernel(&pre, kernels[k]) != 0) continue;
+
+                        memset(out, 0, (size_t)w * h);
+                        preprocess_run(&pre, src, stride, w, h, out, w);
+                        failed += compare(preprocess_kernel_name(kernels[k]), factor, blur, w, h, out, scalar);
+                        tested[k] = 1;
+                        checked++;
+                    }
+                }
+            }
+
+            preprocess_destroy(&pre);
+        }
+    }
+
+    for (size_t k = 0; k < sizeof(kernels); k++) {
+        printf("%s kernel: %s\n", preprocess_kernel_name(kernels[k]), tested[k] ? "checked" : "not available here");
+    }
+    printf("%d of %d preprocessing runs match\n", checked - failed, checked);
+
+    free(src);
+    free(gray);
+    free(ref);
+    free(scalar);
+    free(out);
+
+    return failed != 0;
+}
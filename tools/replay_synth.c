@@ -0,0 +1,79 @@
+// writes a raw recording of a 2x2 grid of tag36h11 tags, ids 0 to 3, drifting across a 640x480 frame
+// replayed with settings/alloc_test.json it gives every stage a pose per frame without a camera
+//
+// replay_synth <out.raw> [frames]
+
+#include <replay.h>
+
+#include <apriltag/apriltag.h>
+#include <apriltag/tag36h11.h>
+
+#define SYNTH_WIDTH 640
+#define SYNTH_HEIGHT 480
+#define SYNTH_CELL 8 // px per tag bit, the black border is 8 bits wide so 64 px, 0.084 m at 0.79 m with fx 600
+#define SYNTH_SPACING 114 // px between tag centers, 0.15 m at the same range
+#define SYNTH_DRIFT 40 // px the grid moves back and forth
+#define SYNTH_PERIOD 33333 // us between frames
+#define SYNTH_DEFAULT_FRAMES 400
+
+static void draw_tag(image_u8_t *frame, image_u8_t *tag, int cx, int cy) {
+    int size = tag->width * SYNTH_CELL;
+    int x0 = cx - size / 2, y0 = cy - size / 2;
+
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int fx = x0 + x, fy = y0 + y;
+            if (fx < 0 || fy < 0 || fx >= frame->width || fy >= frame->height) continue;
+
+            frame->buf[fy * frame->stride + fx] = tag->buf[(y / SYNTH_CELL) * tag->stride + x / SYNTH_CELL];
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <out.raw> [frames]\n", argv[0]);
+        return 1;
+    }
+
+    int frames = argc > 2 ? atoi(argv[2]) : SYNTH_DEFAULT_FRAMES;
+    if (frames < 1) frames = SYNTH_DEFAULT_FRAMES;
+
+    Recorder rec = { 0 };
+    if (recorder_open(&rec, argv[1], SYNTH_WIDTH, SYNTH_HEIGHT) != 0) return 2;
+
+    apriltag_family_t *tf = tag36h11_create();
+    image_u8_t *tags[4];
+    for (int id = 0; id < 4; id++) tags[id] = apriltag_to_image(tf, id);
+
+    image_u8_t *frame = image_u8_create(SYNTH_WIDTH, SYNTH_HEIGHT);
+
+    int ec = 0;
+    for (int i = 0; i < frames && ec == 0; i++) {
+        // a triangle wave so consecutive frames stay close, like a slowly moving camera
+        int phase = i % (2 * SYNTH_DRIFT);
+        int dx = (phase < SYNTH_DRIFT ? phase : 2 * SYNTH_DRIFT - phase) - SYNTH_DRIFT / 2;
+        int dy = dx / 2;
+
+        for (int y = 0; y < frame->height; y++) memset(frame->buf + y * frame->stride, 0xff, frame->width);
+
+        // laid out like tag_map_from_grid, id % 2 across and id / 2 down
+        for (int id = 0; id < 4; id++) {
+            int cx = SYNTH_WIDTH / 2 + dx + ((id % 2) * 2 - 1) * SYNTH_SPACING / 2;
+            int cy = SYNTH_HEIGHT / 2 + dy + ((id / 2) * 2 - 1) * SYNTH_SPACING / 2;
+            draw_tag(frame, tags[id], cx, cy);
+        }
+
+        ec = recorder_write(&rec, frame, (gint64)i * SYNTH_PERIOD);
+    }
+
+    if (ec) fprintf(stderr, "Writing frame failed with error code: %d\n", ec);
+    else printf("Wrote %d frames to %s\n", frames, argv[1]);
+
+    image_u8_destroy(frame);
+    for (int id = 0; id < 4; id++) image_u8_destroy(tags[id]);
+    tag36h11_destroy(tf);
+
+    if (recorder_close(&rec) != 0) return 3;
+    return ec != 0;
+}
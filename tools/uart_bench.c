@@ -0,0 +1,410 @@
+// end to end benchmark without a camera or a serial port
+// a pseudo terminal stands in for the UART, the tracker writes to its slave end and this reads the master end,
+// decodes every packet and reports rate, loss, CRC failures and latency against the timestamps in the packets
+// run the tracker from a replay (source_mode 1 or 2) and the whole pipeline runs on any Linux machine
+// pings from a tracker with clock_sync are answered like the controller would, on this machine's clock, which is
+// the tracker's own, so the synchronized timestamps still compare directly
+//
+// uart_bench <settings.json> <tracker> [seconds]   runs the tracker with uart_path pointed at the pty
+// uart_bench --listen [seconds]                    only creates the pty and prints its path, for a tracker started by hand
+// uart_bench --self-test                           round trips the compact encoding and prints its worst errors
+
+#define _GNU_SOURCE
+
+#include <pose_packet.h>
+#include <timestamps.h>
+
+#include <json-c/json.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define BENCH_SETTINGS "/tmp/uart_bench_XXXXXX.json" // template for mkstemps, unique per run
+#define BENCH_MAX_SAMPLES (1 << 20) // latencies kept for the percentiles, later ones only go into the averages
+#define BENCH_REPORT_US 1000000 // interval between progress lines
+#define BENCH_DEFAULT_BAUD 115200
+
+// worst case round trip error of the compact encoding
+#define COMPACT_MAX_POS_ERROR 0.00051 // m, half a mm step and the float rounding of the input
+#define COMPACT_MAX_ANGLE_ERROR 0.005 // rad, about 0.3 degrees from 10 bit components
+#define COMPACT_MAX_SIGMA_ERROR 0.03 // relative, half a step of 2^(1/12)
+
+typedef struct _LatencyStats {
+    int64_t *samples;
+    size_t n;
+    uint64_t count;
+    double sum;
+    int64_t min, max;
+} LatencyStats;
+
+typedef struct _Bench {
+    PacketParser parser;
+    uint64_t packets; // pose packets, the parser counts every type
+    uint64_t pongs;
+    uint64_t compact; // of those, in the compact encoding
+    uint64_t bytes;
+    uint64_t lost; // packets missing from the sequence
+    uint64_t predicted;
+    int have_seq;
+    uint16_t last_seq;
+
+    LatencyStats measured; // receive time - capture time, glass to receiver
+    LatencyStats ahead; // receive time - prediction time, negative when the pose is for the future
+
+    int64_t start;
+    int baud;
+} Bench;
+
+// largest round trip errors compact_pose_self_test saw
+typedef struct _CompactErrors {
+    double position; // m
+    double angle; // rad
+    double sigma; // relative
+    uint64_t poses;
+} CompactErrors;
+
+// angle of the rotation between two unit quaternions
+static double quat_angle(const float a[4], const float b[4]) {
+    double d = fabs((double)a[0] * b[0] + (double)a[1] * b[1] + (double)a[2] * b[2] + (double)a[3] * b[3]);
+    return 2 * acos(d > 1 ? 1 : d);
+}
+
+// encodes and decodes a fixed set of poses in the compact form and checks every error against the COMPACT_MAX bounds
+// returns 0 if all of them are inside, errors gets the largest ones seen
+static int compact_pose_self_test(CompactErrors *errors) {
+    uint8_t buf[COMPACT_PACKET_SIZE];
+    PosePacket in, out;
+    uint32_t state = 12345;
+
+    memset(errors, 0, sizeof(CompactErrors));
+
+    for (int k = 0; k < 20000; k++) {
+        // a fixed pseudo random sequence, so a failure is the same every run
+        float r[13];
+        for (int i = 0; i < 13; i++) {
+            state = state * 1664525 + 1013904223;
+            r[i] = (state >> 8) / 16777216.0f;
+        }
+
+        memset(&in, 0, sizeof(PosePacket));
+        in.seq = (uint16_t)k;
+        in.time = ((uint64_t)state << 16) & 0xFFFFFFFFFFFF;
+        for (int i = 0; i < 3; i++) in.position[i] = (r[i] - 0.5f) * 200;
+
+        // the corners of the quaternion range are where smallest three is worst, every fourth one is on an axis
+        double n = 0;
+        for (int i = 0; i < 4; i++) {
+            in.quat[i] = k % 4 == 0 && i != k / 4 % 4 ? 0 : r[3 + i] - 0.5f;
+            n += in.quat[i] * in.quat[i];
+        }
+        if (n < 1e-6) continue;
+        for (int i = 0; i < 4; i++) in.quat[i] /= sqrt(n);
+
+        for (int i = 0; i < 3; i++) {
+            in.pos_sigma[i] = 1e-4f * exp2f(r[7 + i] * 16);
+            in.att_sigma[i] = 1e-4f * exp2f(r[10 + i] * 14);
+        }
+        in.ntags = k % 7;
+        in.flags = k % 16;
+
+        size_t size = compact_pose_encode(&in, buf);
+        if (size != COMPACT_PACKET_SIZE || pose_packet_decode(buf, size, &out) != 0) return 1;
+
+        if (out.seq != in.seq || out.time != in.time || out.ntags != in.ntags || out.flags != in.flags) return 1;
+
+        for (int i = 0; i < 3; i++) {
+            double e = fabs(out.position[i] - in.position[i]);
+            if (e > errors->position) errors->position = e;
+
+            e = fabs(out.pos_sigma[i] / in.pos_sigma[i] - 1);
+            if (e > errors->sigma) errors->sigma = e;
+            e = fabs(out.att_sigma[i] / in.att_sigma[i] - 1);
+            if (e > errors->sigma) errors->sigma = e;
+        }
+
+        double e = quat_angle(in.quat, out.quat);
+        if (e > errors->angle) errors->angle = e;
+
+        errors->poses++;
+    }
+
+    return errors->position > COMPACT_MAX_POS_ERROR || errors->angle > COMPACT_MAX_ANGLE_ERROR
+        || errors->sigma > COMPACT_MAX_SIGMA_ERROR;
+}
+
+static volatile sig_atomic_t stop;
+
+static void handle_sigint(int sig) {
+    stop = 1;
+}
+
+static int latency_init(LatencyStats *ls) {
+    memset(ls, 0, sizeof(LatencyStats));
+    ls->samples = (int64_t *)malloc(BENCH_MAX_SAMPLES * sizeof(int64_t));
+    ls->min = INT64_MAX;
+    ls->max = INT64_MIN;
+    return ls->samples == NULL;
+}
+
+static void latency_add(LatencyStats *ls, int64_t v) {
+    if (ls->n < BENCH_MAX_SAMPLES) ls->samples[ls->n++] = v;
+    ls->count++;
+    ls->sum += v;
+    if (v < ls->min) ls->min = v;
+    if (v > ls->max) ls->max = v;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void latency_print(LatencyStats *ls, const char *name) {
+    if (ls->count == 0) {
+        printf("%s: none\n", name);
+        return;
+    }
+
+    qsort(ls->samples, ls->n, sizeof(int64_t), compare_int64);
+    printf("%s (us): min %lld, avg %.0f, p50 %lld, p99 %lld, max %lld\n", name,
+        (long long)ls->min, ls->sum / ls->count, (long long)ls->samples[ls->n / 2],
+        (long long)ls->samples[(size_t)(ls->n * 0.99)], (long long)ls->max);
+}
+
+static void bench_packet(Bench *b, PosePacket *pkt, int64_t now) {
+    // both ends use CLOCK_MONOTONIC on the same machine, so the timestamps compare directly
+    if (pkt->flags & POSE_FLAG_PREDICTED) {
+        b->predicted++;
+        latency_add(&b->ahead, now - (int64_t)pkt->time);
+    }
+    else {
+        latency_add(&b->measured, now - (int64_t)pkt->time);
+    }
+
+    b->packets++;
+    if (b->have_seq) b->lost += (uint16_t)(pkt->seq - b->last_seq - 1);
+    b->last_seq = pkt->seq;
+    b->have_seq = 1;
+}
+
+// answers straight away, so t2 and t3 are the same
+static void bench_pong(Bench *b, int fd, int64_t now) {
+    PingPacket ping;
+    uint8_t out[POSE_PACKET_MAX];
+
+    if (ping_payload_parse(b->parser.payload, b->parser.payload_len, &ping)) return;
+
+    PongPacket pong = { .seq = ping.seq, .t1 = ping.t1, .t2 = (uint64_t)now, .t3 = (uint64_t)monotonic_us() };
+    size_t size = pong_packet_encode(&pong, out);
+    if (write(fd, out, size) == (ssize_t)size) b->pongs++;
+}
+
+// decodes everything waiting on the master end
+static void bench_read(Bench *b, int fd) {
+    uint8_t buf[4096];
+    PosePacket pkt;
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        int64_t now = monotonic_us();
+        b->bytes += n;
+
+        for (ssize_t i = 0; i < n; i++) {
+            int type = packet_parser_feed(&b->parser, buf[i]);
+            if (type == PACKET_POSE && pose_payload_parse(b->parser.payload, b->parser.payload_len, &pkt) == 0) {
+                bench_packet(b, &pkt, now);
+            }
+            else if (type == PACKET_POSE_COMPACT && compact_payload_parse(b->parser.payload, b->parser.payload_len, &pkt) == 0) {
+                b->compact++;
+                bench_packet(b, &pkt, now);
+            }
+            else if (type == PACKET_PING) {
+                bench_pong(b, fd, now);
+            }
+        }
+    }
+}
+
+static void bench_progress(Bench *b, int64_t now) {
+    double s = (now - b->start) / 1e6;
+    printf("%.1f s: %llu packets (%.1f/s), %llu lost, %llu CRC errors, %llu predicted\n", s,
+        (unsigned long long)b->packets, b->packets / s, (unsigned long long)b->lost,
+        (unsigned long long)b->parser.crc_errors, (unsigned long long)b->predicted);
+}
+
+static void bench_report(Bench *b) {
+    double s = (monotonic_us() - b->start) / 1e6;
+
+    printf("\n%llu packets in %.1f s, %.1f/s, %llu bytes\n", (unsigned long long)b->packets, s,
+        b->packets / s, (unsigned long long)b->bytes);
+    if (b->compact > 0) printf("%llu of them compact\n", (unsigned long long)b->compact);
+    if (b->pongs > 0) printf("Answered %llu clock sync pings\n", (unsigned long long)b->pongs);
+    printf("Lost %llu, CRC errors %llu, unknown packets %llu, bytes skipped %llu\n", (unsigned long long)b->lost,
+        (unsigned long long)b->parser.crc_errors, (unsigned long long)b->parser.unknown, (unsigned long long)b->parser.skipped);
+    latency_print(&b->measured, "Measured pose latency");
+    latency_print(&b->ahead, "Predicted pose age");
+
+    // a pty moves bytes as fast as they come, a real UART at this baud rate has 10 bits per byte to send
+    printf("At %d baud this traffic would use %.1f%% of the link\n", b->baud, 100.0 * b->bytes * 10 / s / b->baud);
+}
+
+// raw mode on either end, so no byte is translated or echoed back
+static int make_raw(int fd) {
+    struct termios t;
+    if (tcgetattr(fd, &t) != 0) return -1;
+    cfmakeraw(&t);
+    return tcsetattr(fd, TCSANOW, &t);
+}
+
+// copies the settings with uart_path pointed at the pty into a new file at path, and reads the baud rate the tracker will use
+// path is a BENCH_SETTINGS template and gets the name of the file, so runs side by side don't overwrite each other's
+static int write_settings(const char *src, const char *slave, int *baud, char *path) {
+    json_object *root = json_object_from_file(src);
+    json_object *tmp;
+
+    if (root == NULL) {
+        fprintf(stderr, "Couldn't read %s\n", src);
+        return -1;
+    }
+
+    if (json_object_object_get_ex(root, "uart_baudrate", &tmp)) *baud = json_object_get_int(tmp);
+
+    json_object_object_add(root, "uart_path", json_object_new_string(slave));
+
+    int fd = mkstemps(path, 5);
+    if (fd < 0) {
+        perror("Couldn't create the settings file");
+        json_object_put(root);
+        return -1;
+    }
+
+    int ec = json_object_to_fd(fd, root, JSON_C_TO_STRING_PRETTY);
+    json_object_put(root);
+    close(fd);
+
+    if (ec != 0) {
+        fprintf(stderr, "Couldn't write %s\n", path);
+        unlink(path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // progress lines show up as they happen even when piped
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (argc >= 2 && strcmp(argv[1], "--self-test") == 0) {
+        CompactErrors errors;
+        int ec = compact_pose_self_test(&errors);
+        printf("Compact encoding, %llu poses: position %.3f mm (max %.3f), angle %.3f deg (max %.3f), sigma %.1f%% (max %.1f%%)\n",
+            (unsigned long long)errors.poses, errors.position * 1000, COMPACT_MAX_POS_ERROR * 1000,
+            errors.angle * 180 / M_PI, COMPACT_MAX_ANGLE_ERROR * 180 / M_PI, errors.sigma * 100, COMPACT_MAX_SIGMA_ERROR * 100);
+        printf("%s\n", ec ? "FAILED" : "Passed");
+        return ec;
+    }
+
+    int listen_only = argc >= 2 && strcmp(argv[1], "--listen") == 0;
+
+    if (!listen_only && argc < 3) {
+        fprintf(stderr, "Usage: %s <settings.json> <tracker> [seconds]\n       %s --listen [seconds]\n       %s --self-test\n",
+            argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    const char *duration_arg = listen_only ? (argc >= 3 ? argv[2] : NULL) : (argc >= 4 ? argv[3] : NULL);
+    double duration = duration_arg != NULL ? atof(duration_arg) : 0;
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("Couldn't create a pseudo terminal");
+        return 2;
+    }
+    const char *slave = ptsname(master);
+
+    // held open here too, otherwise the master reads EIO whenever the tracker has it closed
+    int keep = open(slave, O_RDWR | O_NOCTTY);
+    if (keep < 0 || make_raw(master) != 0 || make_raw(keep) != 0) {
+        perror("Couldn't set up the pseudo terminal");
+        return 2;
+    }
+
+    Bench b;
+    memset(&b, 0, sizeof(Bench));
+    packet_parser_init(&b.parser);
+    if (latency_init(&b.measured) || latency_init(&b.ahead)) {
+        perror("Latency buffer allocation failed");
+        return 3;
+    }
+    b.baud = BENCH_DEFAULT_BAUD;
+
+    pid_t child = -1;
+    char settings_path[] = BENCH_SETTINGS;
+    if (listen_only) {
+        printf("Listening on %s\n", slave);
+    }
+    else {
+        if (write_settings(argv[1], slave, &b.baud, settings_path)) return 4;
+
+        child = fork();
+        if (child == 0) {
+            execl(argv[2], argv[2], settings_path, (char *)NULL);
+            perror("Couldn't start the tracker");
+            _exit(127);
+        }
+        printf("Tracker %d writing to %s\n", (int)child, slave);
+    }
+
+    signal(SIGINT, handle_sigint);
+
+    b.start = monotonic_us();
+    int64_t next_report = b.start + BENCH_REPORT_US;
+
+    while (!stop) {
+        struct pollfd pfd = { .fd = master, .events = POLLIN };
+        poll(&pfd, 1, 100);
+
+        bench_read(&b, master);
+
+        int64_t now = monotonic_us();
+        if (now >= next_report) {
+            bench_progress(&b, now);
+            next_report += BENCH_REPORT_US;
+        }
+
+        if (duration > 0 && now - b.start >= duration * 1e6) break;
+
+        // the tracker exits by itself once a replay is done
+        if (child > 0 && waitpid(child, NULL, WNOHANG) == child) {
+            child = -1;
+            break;
+        }
+    }
+
+    if (child > 0) {
+        kill(child, SIGINT);
+        waitpid(child, NULL, 0);
+    }
+    if (!listen_only) unlink(settings_path);
+
+    // whatever the tracker wrote just before it exited
+    bench_read(&b, master);
+
+    bench_report(&b);
+
+    close(keep);
+    close(master);
+    free(b.measured.samples);
+    free(b.ahead.samples);
+
+    return 0;
+}